@@ -0,0 +1,391 @@
+#pragma once
+
+// std::pmr memory resources for allocation-heavy parallel code.
+//
+//   pc::PoolResource pool;                      // shared by all threads
+//   ThreadSafeQueue<int> q("jobs", &pool);      // queue chunks come from the pool
+//
+//   pc::Arena arena(1 << 20);                   // one per operation or thread
+//   Matrix<double> t(n, n, &arena);             // temporaries bump-allocated
+//   arena.reset();                              // everything at once, blocks kept
+//   auto mark = arena.checkpoint();             // or back to a point, e.g. per
+//   arena.reset(mark);                          // iteration of a loop
+//
+//   pc::Arena big(256 << 20, pc::huge_pages()); // arena blocks on 2 MiB pages
+//
+// PoolResource serves blocks of up to max_block bytes from power-of-two size
+// classes. Free lists are sharded by thread: each thread allocates from its
+// own shard, so threads only meet on the shard lock when there are more
+// threads than shards. Empty free lists are refilled by carving a slab from
+// the upstream resource. Slabs are aligned to their size and start with the
+// index of the shard that carved them, so a freed block always goes back to
+// its owner: onto the owner's list when the owner frees it, otherwise onto
+// the owner's lock-free remote list, which the owner takes over when its
+// own list runs dry. Memory freed by consumer threads is therefore reused
+// by the producers that allocated it instead of piling up on the consumers'
+// shards. Slabs go back only when the pool is destroyed. Larger or
+// over-aligned requests go upstream directly.
+//
+// Arena is a bump allocator for the temporaries of one operation:
+// deallocate() does nothing and reset() rewinds to the first block while
+// keeping every block for the next operation. It is not thread-safe.
+//
+// HugePageResource maps whole 2 MiB pages: MAP_HUGETLB, else transparent
+// huge pages through madvise on Linux, MEM_LARGE_PAGES on Windows (needs the
+// "Lock pages in memory" privilege), and ordinary pages when neither is
+// available. Every block honours the requested alignment up to the page
+// size, also on the ordinary-page path, where the mapping is over-allocated
+// and trimmed (Linux) or placed at an aligned address (Windows); aligned
+// mappings also let MADV_HUGEPAGE actually produce transparent huge pages.
+// Meant as the upstream of large arenas, not for small blocks.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace pc {
+
+class PoolResource : public std::pmr::memory_resource {
+private:
+	static constexpr size_t min_block = 16;
+	static constexpr size_t slab_align = 64;
+
+	struct FreeBlock {
+		FreeBlock* next;
+	};
+
+	struct alignas(64) Shard {
+		std::mutex mtx;
+		std::vector<FreeBlock*> heads;
+		// Blocks of this shard freed by other threads, one stack per class.
+		std::unique_ptr<std::atomic<FreeBlock*>[]> remote;
+	};
+
+	// At the start of every slab; blocks follow from slab_align on.
+	struct SlabHeader {
+		int owner;
+	};
+
+	size_t max_block;
+	size_t slab_bytes;
+	int class_count = 0;
+	std::pmr::memory_resource* upstream;
+	std::unique_ptr<Shard[]> shards;
+	int shard_count;
+	std::mutex slab_mtx;
+	std::vector<void*> slabs;
+
+	static int thread_slot() {
+		static std::atomic<int> next{ 0 };
+		thread_local int slot = next++;
+		return slot;
+	}
+
+	// Size class of a request, or -1 when it bypasses the pool.
+	int class_of(size_t bytes, size_t alignment) const {
+		size_t block = min_block;
+		int c = 0;
+		while (block < bytes) {
+			block <<= 1;
+			++c;
+		}
+		if (c >= class_count || alignment > std::min(block, slab_align)) return -1;
+		return c;
+	}
+
+	int owner_of(void* p) const {
+		const size_t base = reinterpret_cast<size_t>(p) & ~(slab_bytes - 1);
+		return reinterpret_cast<const SlabHeader*>(base)->owner;
+	}
+
+	FreeBlock* carve(int c, int owner) {
+		const size_t block = min_block << c;
+		void* base;
+		{
+			std::lock_guard<std::mutex> lock(slab_mtx);
+			base = upstream->allocate(slab_bytes, slab_bytes);
+			slabs.push_back(base);
+		}
+		static_cast<SlabHeader*>(base)->owner = owner;
+		char* p = static_cast<char*>(base) + slab_align;
+		FreeBlock* head = nullptr;
+		for (size_t i = (slab_bytes - slab_align) / block; i-- > 0;) {
+			FreeBlock* f = reinterpret_cast<FreeBlock*>(p + i * block);
+			f->next = head;
+			head = f;
+		}
+		return head;
+	}
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override {
+		int c = class_of(bytes, alignment);
+		if (c < 0) return upstream->allocate(bytes, alignment);
+
+		const int index = thread_slot() % shard_count;
+		Shard& s = shards[index];
+		std::lock_guard<std::mutex> lock(s.mtx);
+		FreeBlock* f = s.heads[c];
+		if (!f) f = s.remote[c].exchange(nullptr, std::memory_order_acquire);
+		if (!f) f = carve(c, index);
+		s.heads[c] = f->next;
+		return f;
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+		int c = class_of(bytes, alignment);
+		if (c < 0) {
+			upstream->deallocate(p, bytes, alignment);
+			return;
+		}
+
+		const int owner = owner_of(p);
+		Shard& s = shards[owner];
+		FreeBlock* f = static_cast<FreeBlock*>(p);
+		if (owner == thread_slot() % shard_count) {
+			std::lock_guard<std::mutex> lock(s.mtx);
+			f->next = s.heads[c];
+			s.heads[c] = f;
+			return;
+		}
+
+		// Only the owner takes from the remote stack, and it takes the whole
+		// stack at once, so a plain push cannot suffer from ABA.
+		std::atomic<FreeBlock*>& remote = s.remote[c];
+		f->next = remote.load(std::memory_order_relaxed);
+		while (!remote.compare_exchange_weak(f->next, f, std::memory_order_release, std::memory_order_relaxed)) {
+		}
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+	// shards = 0 uses twice the hardware thread count. The slab size is
+	// rounded up to a power of two that holds at least 8 of the largest
+	// blocks.
+	explicit PoolResource(size_t max_block_bytes = 4096, int shards_wanted = 0,
+		std::pmr::memory_resource* upstream_resource = std::pmr::get_default_resource(), size_t slab = 64 << 10)
+		: max_block(std::max(max_block_bytes, min_block)), slab_bytes(slab_align), upstream(upstream_resource) {
+		for (size_t block = min_block; block <= max_block; block <<= 1) ++class_count;
+		while (slab_bytes < std::max(slab, slab_align + (min_block << (class_count - 1)) * 8)) slab_bytes <<= 1;
+		shard_count = shards_wanted > 0 ? shards_wanted : std::max(1, 2 * (int)std::thread::hardware_concurrency());
+		shards.reset(new Shard[shard_count]);
+		for (int i = 0; i < shard_count; ++i) {
+			shards[i].heads.assign(class_count, nullptr);
+			shards[i].remote.reset(new std::atomic<FreeBlock*>[class_count]);
+			for (int c = 0; c < class_count; ++c) shards[i].remote[c].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	~PoolResource() {
+		for (void* base : slabs) upstream->deallocate(base, slab_bytes, slab_bytes);
+	}
+
+	// Bytes taken from upstream for slabs so far.
+	size_t upstream_bytes() {
+		std::lock_guard<std::mutex> lock(slab_mtx);
+		return slabs.size() * slab_bytes;
+	}
+
+	PoolResource(const PoolResource&) = delete;
+	PoolResource& operator=(const PoolResource&) = delete;
+};
+
+class Arena : public std::pmr::memory_resource {
+private:
+	struct Block {
+		char* base;
+		size_t bytes;
+		size_t alignment;
+	};
+
+	std::pmr::memory_resource* upstream;
+	size_t block_bytes;
+	std::vector<Block> blocks;
+	size_t current = 0;
+	size_t offset = 0;
+	size_t peak = 0;
+
+	static size_t align_up(size_t n, size_t alignment) { return (n + alignment - 1) & ~(alignment - 1); }
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override {
+		for (; current < blocks.size(); ++current, offset = 0) {
+			const Block& b = blocks[current];
+			size_t start = align_up((size_t)b.base + offset, alignment) - (size_t)b.base;
+			if (start + bytes <= b.bytes) {
+				offset = start + bytes;
+				peak = std::max(peak, used());
+				return b.base + start;
+			}
+		}
+
+		size_t size = std::max(block_bytes, align_up(bytes, alignment));
+		size_t block_alignment = std::max(alignment, alignof(std::max_align_t));
+		char* base = static_cast<char*>(upstream->allocate(size, block_alignment));
+		blocks.push_back(Block{ base, size, block_alignment });
+		current = blocks.size() - 1;
+		offset = bytes;
+		peak = std::max(peak, used());
+		return base;
+	}
+
+	void do_deallocate(void*, size_t, size_t) override {}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+	explicit Arena(size_t block = 1 << 20, std::pmr::memory_resource* upstream_resource = std::pmr::get_default_resource())
+		: upstream(upstream_resource), block_bytes(block) {}
+
+	~Arena() { release(); }
+
+	struct Checkpoint {
+		size_t block;
+		size_t offset;
+	};
+
+	Checkpoint checkpoint() const { return Checkpoint{ current, offset }; }
+
+	// Forgets every allocation made after the checkpoint (all of them by
+	// default); the blocks are reused by later ones.
+	void reset(Checkpoint to = Checkpoint{ 0, 0 }) {
+		current = to.block;
+		offset = to.offset;
+	}
+
+	// Returns the blocks upstream.
+	void release() {
+		for (const Block& b : blocks) upstream->deallocate(b.base, b.bytes, b.alignment);
+		blocks.clear();
+		reset();
+	}
+
+	size_t used() const {
+		size_t n = offset;
+		for (size_t i = 0; i < current && i < blocks.size(); ++i) n += blocks[i].bytes;
+		return n;
+	}
+
+	size_t capacity() const {
+		size_t n = 0;
+		for (const Block& b : blocks) n += b.bytes;
+		return n;
+	}
+
+	size_t high_water() const { return peak; }
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+};
+
+class HugePageResource : public std::pmr::memory_resource {
+private:
+	std::atomic<size_t> huge{ 0 };
+	std::atomic<size_t> fallback{ 0 };
+
+	static size_t page_bytes() {
+#ifdef _WIN32
+		size_t large = GetLargePageMinimum();
+		return large > 0 ? large : size_t(2) << 20;
+#else
+		return size_t(2) << 20;
+#endif
+	}
+
+	static size_t round_up(size_t bytes) {
+		size_t page = page_bytes();
+		return (bytes + page - 1) / page * page;
+	}
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override {
+		if (alignment > page_bytes()) throw std::bad_alloc();
+		size_t size = round_up(bytes);
+#ifdef _WIN32
+		void* p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (p) {
+			huge += size;
+			return p;
+		}
+		// VirtualAlloc aligns to the 64 KiB allocation granularity. For more,
+		// find a free aligned range by reserving extra and retry if another
+		// thread takes it between the release and the allocation.
+		if (alignment <= (64 << 10)) {
+			p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		}
+		for (int attempt = 0; !p && alignment > (64 << 10) && attempt < 16; ++attempt) {
+			void* range = VirtualAlloc(nullptr, size + alignment, MEM_RESERVE, PAGE_NOACCESS);
+			if (!range) break;
+			void* aligned = (void*)(((size_t)range + alignment - 1) & ~(alignment - 1));
+			VirtualFree(range, 0, MEM_RELEASE);
+			p = VirtualAlloc(aligned, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		}
+		if (!p) throw std::bad_alloc();
+		fallback += size;
+		return p;
+#else
+		void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			huge += size;
+			return p;
+		}
+#endif
+		// Ordinary mappings are only page aligned: map one huge page extra and
+		// unmap the slack on both sides of the aligned range.
+		const size_t page = page_bytes();
+		p = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) throw std::bad_alloc();
+		char* start = static_cast<char*>(p);
+		char* aligned = (char*)(((size_t)start + page - 1) & ~(page - 1));
+		if (aligned > start) munmap(start, aligned - start);
+		if (aligned + size < start + size + page) munmap(aligned + size, start + page - aligned);
+		p = aligned;
+#ifdef MADV_HUGEPAGE
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+		fallback += size;
+		return p;
+#endif
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t) override {
+#ifdef _WIN32
+		(void)bytes;
+		VirtualFree(p, 0, MEM_RELEASE);
+#else
+		munmap(p, round_up(bytes));
+#endif
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+	// Bytes mapped with explicit huge pages and with ordinary (or
+	// transparent huge) pages so far.
+	size_t huge_page_bytes() const { return huge; }
+	size_t fallback_bytes() const { return fallback; }
+};
+
+inline HugePageResource* huge_pages() {
+	static HugePageResource resource;
+	return &resource;
+}
+
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+// Empirical auto-tuner with a per-machine cache.
+//
+// Tuner::tune(op, size, space, measure) returns the best configuration for an
+// operation and problem-size bucket (powers of two). The first call on a
+// machine searches the parameter space by coordinate descent, timing each
+// candidate through the caller's measure() function; the winner is written to
+// the cache file keyed by CPU model, so later runs just read it back.
+//
+// The cache is a tab-separated text file, one line per winner:
+//   cpu model <TAB> operation <TAB> size bucket <TAB> name=value,... <TAB> ms
+// Default location is ./paracomp_tune.cache, overridable with the
+// PARACOMP_TUNE_CACHE environment variable.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+#include "cpu_features.h"
+
+namespace tune {
+
+// CPU brand string plus the logical core count, so that VMs of the same SKU
+// with different sizes do not share entries.
+inline std::string cpu_model() {
+	char brand[49] = {};
+#if defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 0x80000000);
+	if ((unsigned)regs[0] >= 0x80000004u) {
+		for (int i = 0; i < 3; ++i) {
+			__cpuid(regs, 0x80000002 + i);
+			std::memcpy(brand + 16 * i, regs, 16);
+		}
+	}
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	unsigned regs[4];
+	if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004u) {
+		for (int i = 0; i < 3; ++i) {
+			__get_cpuid(0x80000002 + i, &regs[0], &regs[1], &regs[2], &regs[3]);
+			std::memcpy(brand + 16 * i, regs, 16);
+		}
+	}
+#endif
+	std::string model(brand);
+	model.erase(0, model.find_first_not_of(' '));
+	model.erase(model.find_last_not_of(' ') + 1);
+	std::replace(model.begin(), model.end(), '\t', ' ');
+	if (model.empty()) model = "unknown-cpu";
+	return model + " x" + std::to_string(std::thread::hardware_concurrency());
+}
+
+inline int size_bucket(long long n) {
+	int bucket = 0;
+	while (n > 1) {
+		n >>= 1;
+		++bucket;
+	}
+	return bucket;
+}
+
+struct Param {
+	std::string name;
+	std::vector<long long> candidates;
+};
+
+struct Config {
+	std::map<std::string, long long> values;
+
+	long long get(const std::string& name, long long def) const {
+		auto it = values.find(name);
+		return it == values.end() ? def : it->second;
+	}
+
+	std::string to_string() const {
+		std::ostringstream out;
+		bool first = true;
+		for (const auto& v : values) {
+			if (!first) out << ",";
+			out << v.first << "=" << v.second;
+			first = false;
+		}
+		return out.str();
+	}
+
+	static Config parse(const std::string& text) {
+		Config c;
+		std::istringstream in(text);
+		std::string item;
+		while (std::getline(in, item, ',')) {
+			size_t eq = item.find('=');
+			if (eq != std::string::npos) c.values[item.substr(0, eq)] = std::atoll(item.c_str() + eq + 1);
+		}
+		return c;
+	}
+};
+
+// 1, 2, 4, ... up to the core count, plus the core count itself.
+inline std::vector<long long> thread_candidates() {
+	long long hw = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<long long> c;
+	for (long long t = 1; t < hw; t *= 2) c.push_back(t);
+	c.push_back(hw);
+	return c;
+}
+
+// Vector widths, in elements of element_bytes, for a "simd_width" parameter:
+// 1 (scalar), SSE and, where the CPU has it, AVX.
+inline std::vector<long long> simd_width_candidates(int element_bytes) {
+	std::vector<long long> c = { 1, 16 / element_bytes };
+	if (pc::cpu().avx) c.push_back(32 / element_bytes);
+	return c;
+}
+
+inline std::string default_cache_path() {
+	const char* env = std::getenv("PARACOMP_TUNE_CACHE");
+	return env ? env : "paracomp_tune.cache";
+}
+
+class Tuner {
+private:
+	struct Entry {
+		Config config;
+		double ms;
+	};
+
+	std::string path;
+	std::string cpu;
+	bool force;
+	std::map<std::string, Entry> entries;
+
+	std::string key(const std::string& model, const std::string& op, int bucket) const {
+		return model + "\t" + op + "\t" + std::to_string(bucket);
+	}
+
+	void load() {
+		std::ifstream in(path);
+		std::string line;
+		while (std::getline(in, line)) {
+			std::vector<std::string> fields;
+			std::istringstream row(line);
+			std::string field;
+			while (std::getline(row, field, '\t')) fields.push_back(field);
+			if (fields.size() != 5) continue;
+			entries[key(fields[0], fields[1], std::atoi(fields[2].c_str()))] =
+				Entry{ Config::parse(fields[3]), std::atof(fields[4].c_str()) };
+		}
+	}
+
+public:
+	explicit Tuner(const std::string& cache_path = default_cache_path(), bool retune = false)
+		: path(cache_path), cpu(cpu_model()), force(retune) {
+		load();
+	}
+
+	const std::string& machine() const { return cpu; }
+
+	bool lookup(const std::string& op, long long size, Config& out) const {
+		auto it = entries.find(key(cpu, op, size_bucket(size)));
+		if (it == entries.end()) return false;
+		out = it->second.config;
+		return true;
+	}
+
+	// measure(config) returns a time in ms; lower is better. The caller decides
+	// how many repetitions go into one measurement.
+	Config tune(const std::string& op, long long size, const std::vector<Param>& space,
+		const std::function<double(const Config&)>& measure) {
+		Config best;
+		if (!force && lookup(op, size, best)) return best;
+
+		for (const auto& p : space) {
+			if (!p.candidates.empty()) best.values[p.name] = p.candidates.front();
+		}
+
+		std::map<std::string, double> seen;
+		auto time_of = [&](const Config& c) {
+			std::string k = c.to_string();
+			auto it = seen.find(k);
+			if (it != seen.end()) return it->second;
+			double ms = measure(c);
+			std::cout << "  tuning " << op << " [bucket " << size_bucket(size) << "] " << k << ": " << ms << " ms\n";
+			return seen[k] = ms;
+		};
+
+		// Coordinate descent: optimise one parameter at a time, two sweeps.
+		double best_ms = time_of(best);
+		for (int sweep = 0; sweep < 2; ++sweep) {
+			bool improved = false;
+			for (const auto& p : space) {
+				for (long long v : p.candidates) {
+					Config candidate = best;
+					candidate.values[p.name] = v;
+					double ms = time_of(candidate);
+					if (ms < best_ms) {
+						best_ms = ms;
+						best = candidate;
+						improved = true;
+					}
+				}
+			}
+			if (!improved) break;
+		}
+
+		entries[key(cpu, op, size_bucket(size))] = Entry{ best, best_ms };
+		save();
+		return best;
+	}
+
+	void save() const {
+		std::ofstream out(path);
+		for (const auto& e : entries) {
+			out << e.first << "\t" << e.second.config.to_string() << "\t" << e.second.ms << "\n";
+		}
+	}
+};
+
+// Best of a few runs, in milliseconds; the usual measure() body.
+template<typename F>
+double time_min_ms(F&& body, int repeats = 3) {
+	double best = std::numeric_limits<double>::max();
+	for (int i = 0; i < repeats; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		body();
+		auto stop = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double, std::milli>(stop - start).count());
+	}
+	return best;
+}
+
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+// Batched GEMM over many small matrices: C[b] = A[b] * B[b] for b < count.
+//
+//   pc::batched_gemm<8, 8, 8>(pc::threads(pool, pc::simd), a, b, c, count, pc::Layout::interleaved);
+//
+// The sizes are template parameters, so every loop bound is a compile-time
+// constant. The kernels keep a block of C in registers and unroll the
+// innermost loops with index_sequence rather than relying on the compiler.
+// Two batch layouts:
+//   packed       one matrix after another, each row-major
+//   interleaved  groups of lanes<T>() matrices with the same element side by
+//                side, (group * rows * cols + i * cols + j) * lanes + lane,
+//                so one SIMD register holds that element of several
+//                matrices and the kernel needs no shuffles at any size
+// interleave() and deinterleave() convert between the two; interleaved
+// buffers always hold whole groups (interleaved_size()), zero-padded.
+//
+// The batch is split over the policy like any other range (seq, simd,
+// threads, openmp). batched_gemm(policy, n, ...) dispatches square sizes at
+// run time to the fixed-size kernels for 4, 8, 12, 16, 24 and 32 and to a
+// generic loop for anything else. Needs C++17 (if constexpr).
+
+#include <emmintrin.h>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "policy.h"
+
+namespace pc {
+
+enum class Layout {
+	packed,
+	interleaved
+};
+
+template<typename T> struct Vec;
+
+template<>
+struct Vec<double> {
+	static const int lanes = 2;
+	__m128d v;
+
+	static Vec zero() { return Vec{ _mm_setzero_pd() }; }
+	static Vec broadcast(double x) { return Vec{ _mm_set1_pd(x) }; }
+	static Vec load(const double* p) { return Vec{ _mm_loadu_pd(p) }; }
+	void store(double* p) const { _mm_storeu_pd(p, v); }
+	friend Vec multiply_add(Vec a, Vec b, Vec c) { return Vec{ _mm_add_pd(_mm_mul_pd(a.v, b.v), c.v) }; }
+};
+
+template<>
+struct Vec<float> {
+	static const int lanes = 4;
+	__m128 v;
+
+	static Vec zero() { return Vec{ _mm_setzero_ps() }; }
+	static Vec broadcast(float x) { return Vec{ _mm_set1_ps(x) }; }
+	static Vec load(const float* p) { return Vec{ _mm_loadu_ps(p) }; }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+	friend Vec multiply_add(Vec a, Vec b, Vec c) { return Vec{ _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v) }; }
+};
+
+template<typename T>
+constexpr int lanes() { return Vec<T>::lanes; }
+
+// f(integral_constant<int, 0>) ... f(integral_constant<int, N - 1>), unrolled.
+template<typename F, int... I>
+inline void unroll_impl(F& f, std::integer_sequence<int, I...>) {
+	int expand[] = { 0, (f(std::integral_constant<int, I>()), 0)... };
+	(void)expand;
+}
+
+template<int N, typename F>
+inline void unroll(F&& f) {
+	unroll_impl(f, std::make_integer_sequence<int, N>());
+}
+
+inline long long interleaved_groups(long long count, int width) { return (count + width - 1) / width; }
+
+template<typename T>
+size_t interleaved_size(long long count, int rows, int cols) {
+	return (size_t)interleaved_groups(count, lanes<T>()) * rows * cols * lanes<T>();
+}
+
+template<typename T>
+std::vector<T> interleave(const T* packed, long long count, int rows, int cols) {
+	const int w = lanes<T>(), size = rows * cols;
+	std::vector<T> out(interleaved_size<T>(count, rows, cols), T(0));
+	for (long long m = 0; m < count; ++m) {
+		T* group = out.data() + (size_t)(m / w) * size * w;
+		for (int e = 0; e < size; ++e) group[(size_t)e * w + m % w] = packed[(size_t)m * size + e];
+	}
+	return out;
+}
+
+template<typename T>
+void deinterleave(const T* interleaved, long long count, int rows, int cols, T* packed) {
+	const int w = lanes<T>(), size = rows * cols;
+	for (long long m = 0; m < count; ++m) {
+		const T* group = interleaved + (size_t)(m / w) * size * w;
+		for (int e = 0; e < size; ++e) packed[(size_t)m * size + e] = group[(size_t)e * w + m % w];
+	}
+}
+
+template<int M, int N, int K, typename T>
+struct SmallGemm {
+	static const int W = Vec<T>::lanes;
+	// Columns of C held in registers at once.
+	static const int JB = N < 8 ? N : 8;
+
+	static void packed(seq_policy, const T* a, const T* b, T* c) {
+		for (int i = 0; i < M; ++i) {
+			T acc[N] = {};
+			for (int k = 0; k < K; ++k) {
+				const T x = a[i * K + k];
+				unroll<N>([&](auto j) { acc[j] += x * b[k * N + j]; });
+			}
+			unroll<N>([&](auto j) { c[i * N + j] = acc[j]; });
+		}
+	}
+
+	static void packed(simd_policy, const T* a, const T* b, T* c) {
+		const int vectors = N / W, tail = N % W;
+		for (int i = 0; i < M; ++i) {
+			Vec<T> acc[vectors > 0 ? vectors : 1];
+			T rest[tail > 0 ? tail : 1] = {};
+			unroll<vectors>([&](auto v) { acc[v] = Vec<T>::zero(); });
+			for (int k = 0; k < K; ++k) {
+				const T x = a[i * K + k];
+				const Vec<T> xv = Vec<T>::broadcast(x);
+				const T* row = b + k * N;
+				unroll<vectors>([&](auto v) { acc[v] = multiply_add(xv, Vec<T>::load(row + v * W), acc[v]); });
+				unroll<tail>([&](auto t) { rest[t] += x * row[vectors * W + t]; });
+			}
+			unroll<vectors>([&](auto v) { acc[v].store(c + i * N + v * W); });
+			unroll<tail>([&](auto t) { c[i * N + vectors * W + t] = rest[t]; });
+		}
+	}
+
+	static void interleaved(seq_policy, const T* a, const T* b, T* c) {
+		for (int lane = 0; lane < W; ++lane) {
+			for (int i = 0; i < M; ++i) {
+				T acc[N] = {};
+				for (int k = 0; k < K; ++k) {
+					const T x = a[(i * K + k) * W + lane];
+					unroll<N>([&](auto j) { acc[j] += x * b[(k * N + j) * W + lane]; });
+				}
+				unroll<N>([&](auto j) { c[(i * N + j) * W + lane] = acc[j]; });
+			}
+		}
+	}
+
+	template<int J0>
+	static void interleaved_columns(const T* a, const T* b, T* c, int i) {
+		const int width = N - J0 < JB ? N - J0 : JB;
+		Vec<T> acc[width];
+		unroll<width>([&](auto j) { acc[j] = Vec<T>::zero(); });
+		for (int k = 0; k < K; ++k) {
+			const Vec<T> x = Vec<T>::load(a + (i * K + k) * W);
+			const T* row = b + (k * N + J0) * W;
+			unroll<width>([&](auto j) { acc[j] = multiply_add(x, Vec<T>::load(row + j * W), acc[j]); });
+		}
+		unroll<width>([&](auto j) { acc[j].store(c + (i * N + J0 + j) * W); });
+		if constexpr (J0 + JB < N) interleaved_columns<J0 + JB>(a, b, c, i);
+	}
+
+	static void interleaved(simd_policy, const T* a, const T* b, T* c) {
+		for (int i = 0; i < M; ++i) interleaved_columns<0>(a, b, c, i);
+	}
+};
+
+// Range kernel over matrices (packed) or groups of matrices (interleaved).
+template<int M, int N, int K, typename T>
+struct BatchedGemmKernel {
+	const T* a;
+	const T* b;
+	T* c;
+	Layout layout;
+
+	template<typename Leaf>
+	long long operator()(Leaf leaf, long long begin, long long end) const {
+		const size_t w = layout == Layout::interleaved ? (size_t)lanes<T>() : 1;
+		for (long long m = begin; m < end; ++m) {
+			const T* am = a + (size_t)m * M * K * w;
+			const T* bm = b + (size_t)m * K * N * w;
+			T* cm = c + (size_t)m * M * N * w;
+			if (layout == Layout::interleaved) SmallGemm<M, N, K, T>::interleaved(leaf, am, bm, cm);
+			else SmallGemm<M, N, K, T>::packed(leaf, am, bm, cm);
+		}
+		return end - begin;
+	}
+};
+
+template<int M, int N, int K, typename Policy, typename T>
+void batched_gemm(const Policy& policy, const T* a, const T* b, T* c, long long count, Layout layout = Layout::packed) {
+	BatchedGemmKernel<M, N, K, T> kernel{ a, b, c, layout };
+	long long items = layout == Layout::interleaved ? interleaved_groups(count, lanes<T>()) : count;
+	run_range<long long>(policy, 0, items, kernel);
+}
+
+// Runtime-sized square fallback for sizes without a fixed kernel.
+template<typename T>
+struct BatchedGemmGeneric {
+	const T* a;
+	const T* b;
+	T* c;
+	int n;
+	Layout layout;
+
+	template<typename Leaf>
+	long long operator()(Leaf, long long begin, long long end) const {
+		const int w = layout == Layout::interleaved ? lanes<T>() : 1;
+		const size_t size = (size_t)n * n * w;
+		for (long long m = begin; m < end; ++m) {
+			const T* am = a + m * size;
+			const T* bm = b + m * size;
+			T* cm = c + m * size;
+			for (int lane = 0; lane < w; ++lane) {
+				for (int i = 0; i < n; ++i) {
+					for (int j = 0; j < n; ++j) cm[(i * n + j) * w + lane] = 0;
+					for (int k = 0; k < n; ++k) {
+						const T x = am[(i * n + k) * w + lane];
+						for (int j = 0; j < n; ++j) cm[(i * n + j) * w + lane] += x * bm[(k * n + j) * w + lane];
+					}
+				}
+			}
+		}
+		return end - begin;
+	}
+};
+
+template<typename Policy, typename T>
+void batched_gemm(const Policy& policy, int n, const T* a, const T* b, T* c, long long count, Layout layout = Layout::packed) {
+	switch (n) {
+	case 4: batched_gemm<4, 4, 4>(policy, a, b, c, count, layout); return;
+	case 8: batched_gemm<8, 8, 8>(policy, a, b, c, count, layout); return;
+	case 12: batched_gemm<12, 12, 12>(policy, a, b, c, count, layout); return;
+	case 16: batched_gemm<16, 16, 16>(policy, a, b, c, count, layout); return;
+	case 24: batched_gemm<24, 24, 24>(policy, a, b, c, count, layout); return;
+	case 32: batched_gemm<32, 32, 32>(policy, a, b, c, count, layout); return;
+	}
+	BatchedGemmGeneric<T> kernel{ a, b, c, n, layout };
+	long long items = layout == Layout::interleaved ? interleaved_groups(count, lanes<T>()) : count;
+	run_range<long long>(policy, 0, items, kernel);
+}
+
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+// Shared benchmark harness for the ParaComp labs.
+//
+// A Suite runs every case with warmup and repeated trials, reports
+// median/percentile timings plus a throughput figure, and can write the
+// results as CSV/JSON or compare them against a previously written CSV.
+//
+// Command line (all optional):
+//   --warmup N        untimed runs before measuring (default 1)
+//   --trials N        timed runs per case (default 5)
+//   --csv FILE        write results as CSV
+//   --json FILE       write results as JSON
+//   --compare FILE    compare medians against a CSV from an earlier run
+//   --threshold PCT   slowdown that counts as a regression (default 5)
+//   --<name> A,B,C    sweep values read by the lab through Options::get_list
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench {
+
+// Useful work done by one run of a case, e.g. 2*n^3 flops for a multiply.
+struct Throughput {
+	double amount = 0.0;
+	double scale = 1.0;
+	std::string unit;
+};
+
+inline Throughput none() { return Throughput(); }
+inline Throughput flops(double n) { return Throughput{ n, 1e9, "GFLOP/s" }; }
+inline Throughput bytes(double n) { return Throughput{ n, 1e9, "GB/s" }; }
+inline Throughput evals(double n) { return Throughput{ n, 1e6, "Meval/s" }; }
+inline Throughput messages(double n) { return Throughput{ n, 1e3, "Kmsg/s" }; }
+inline Throughput items(double n) { return Throughput{ n, 1e6, "Mitem/s" }; }
+
+// Timing statistics in milliseconds.
+struct Stats {
+	double min = 0.0;
+	double median = 0.0;
+	double p90 = 0.0;
+	double max = 0.0;
+	double mean = 0.0;
+	double stddev = 0.0;
+};
+
+inline double percentile(const std::vector<double>& sorted, double p) {
+	if (sorted.empty()) return 0.0;
+	double pos = p * (sorted.size() - 1);
+	size_t lo = (size_t)pos;
+	size_t hi = std::min(lo + 1, sorted.size() - 1);
+	return sorted[lo] + (sorted[hi] - sorted[lo]) * (pos - lo);
+}
+
+inline Stats summarize(std::vector<double> samples) {
+	Stats s;
+	if (samples.empty()) return s;
+	std::sort(samples.begin(), samples.end());
+	s.min = samples.front();
+	s.max = samples.back();
+	s.median = percentile(samples, 0.5);
+	s.p90 = percentile(samples, 0.9);
+	double sum = 0.0;
+	for (double x : samples) sum += x;
+	s.mean = sum / samples.size();
+	double sq = 0.0;
+	for (double x : samples) sq += (x - s.mean) * (x - s.mean);
+	s.stddev = samples.size() > 1 ? std::sqrt(sq / (samples.size() - 1)) : 0.0;
+	return s;
+}
+
+struct Result {
+	std::string name;
+	std::string params;
+	int trials = 0;
+	Stats ms;
+	Throughput work;
+
+	double throughput() const {
+		return ms.median > 0.0 ? work.amount / (ms.median * 1e-3) / work.scale : 0.0;
+	}
+
+	std::string key() const { return params.empty() ? name : name + " [" + params + "]"; }
+};
+
+// "n=1000 threads=4" from {{"n", 1000}, {"threads", 4}}.
+inline std::string params(std::initializer_list<std::pair<const char*, long long>> values) {
+	std::ostringstream out;
+	bool first = true;
+	for (const auto& v : values) {
+		if (!first) out << " ";
+		out << v.first << "=" << v.second;
+		first = false;
+	}
+	return out.str();
+}
+
+class Options {
+private:
+	std::map<std::string, std::string> values;
+
+public:
+	Options(int argc = 0, char** argv = nullptr) {
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg.compare(0, 2, "--") != 0) continue;
+			arg = arg.substr(2);
+			size_t eq = arg.find('=');
+			if (eq != std::string::npos) {
+				values[arg.substr(0, eq)] = arg.substr(eq + 1);
+			}
+			else if (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0) {
+				values[arg] = argv[++i];
+			}
+			else {
+				values[arg] = "1";
+			}
+		}
+	}
+
+	bool has(const std::string& key) const { return values.count(key) > 0; }
+
+	std::string get_string(const std::string& key, const std::string& def = "") const {
+		auto it = values.find(key);
+		return it == values.end() ? def : it->second;
+	}
+
+	long long get_int(const std::string& key, long long def) const {
+		auto it = values.find(key);
+		return it == values.end() ? def : std::atoll(it->second.c_str());
+	}
+
+	double get_double(const std::string& key, double def) const {
+		auto it = values.find(key);
+		return it == values.end() ? def : std::atof(it->second.c_str());
+	}
+
+	std::vector<long long> get_list(const std::string& key, std::vector<long long> def) const {
+		auto it = values.find(key);
+		if (it == values.end()) return def;
+		std::vector<long long> list;
+		std::istringstream in(it->second);
+		std::string item;
+		while (std::getline(in, item, ',')) {
+			if (!item.empty()) list.push_back(std::atoll(item.c_str()));
+		}
+		return list.empty() ? def : list;
+	}
+};
+
+class Suite {
+private:
+	std::string suite_name;
+	Options opts;
+	int warmup;
+	int trials;
+	bool reporting = true;
+	std::function<void()> sync;
+	std::vector<Result> results;
+
+	static std::string csv_field(std::string s) {
+		std::replace(s.begin(), s.end(), ',', ';');
+		return s;
+	}
+
+	static std::string json_string(const std::string& s) {
+		std::string out = "\"";
+		for (char c : s) {
+			if (c == '"' || c == '\\') out += '\\';
+			out += c;
+		}
+		return out + "\"";
+	}
+
+	void write_csv(const std::string& path) const {
+		std::ofstream out(path);
+		out << "suite,name,params,trials,min_ms,median_ms,p90_ms,max_ms,mean_ms,stddev_ms,throughput,unit\n";
+		out << std::setprecision(9);
+		for (const auto& r : results) {
+			out << csv_field(suite_name) << "," << csv_field(r.name) << "," << csv_field(r.params) << ","
+				<< r.trials << "," << r.ms.min << "," << r.ms.median << "," << r.ms.p90 << ","
+				<< r.ms.max << "," << r.ms.mean << "," << r.ms.stddev << ","
+				<< r.throughput() << "," << r.work.unit << "\n";
+		}
+	}
+
+	void write_json(const std::string& path) const {
+		std::ofstream out(path);
+		out << std::setprecision(9);
+		out << "{\n  \"suite\": " << json_string(suite_name) << ",\n  \"results\": [\n";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const Result& r = results[i];
+			out << "    {\"name\": " << json_string(r.name) << ", \"params\": " << json_string(r.params)
+				<< ", \"trials\": " << r.trials << ", \"min_ms\": " << r.ms.min
+				<< ", \"median_ms\": " << r.ms.median << ", \"p90_ms\": " << r.ms.p90
+				<< ", \"max_ms\": " << r.ms.max << ", \"mean_ms\": " << r.ms.mean
+				<< ", \"stddev_ms\": " << r.ms.stddev << ", \"throughput\": " << r.throughput()
+				<< ", \"unit\": " << json_string(r.work.unit) << "}"
+				<< (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		out << "  ]\n}\n";
+	}
+
+	// Returns the number of cases whose median got slower than the threshold.
+	int compare(const std::string& path, double threshold_pct) const {
+		std::ifstream in(path);
+		if (!in) {
+			std::cout << "Cannot open baseline " << path << "\n";
+			return 0;
+		}
+
+		std::map<std::string, double> baseline;
+		std::string line;
+		std::getline(in, line);
+		while (std::getline(in, line)) {
+			std::vector<std::string> fields;
+			std::istringstream row(line);
+			std::string field;
+			while (std::getline(row, field, ',')) fields.push_back(field);
+			if (fields.size() < 6) continue;
+			std::string key = fields[2].empty() ? fields[1] : fields[1] + " [" + fields[2] + "]";
+			baseline[key] = std::atof(fields[5].c_str());
+		}
+
+		int regressions = 0;
+		std::cout << "\n=== Comparison with " << path << " ===\n";
+		for (const auto& r : results) {
+			auto it = baseline.find(csv_field(r.key()));
+			if (it == baseline.end() || it->second <= 0.0) continue;
+			double change = (r.ms.median / it->second - 1.0) * 100.0;
+			const char* verdict = change > threshold_pct ? "REGRESSION"
+				: change < -threshold_pct ? "improved" : "same";
+			if (change > threshold_pct) ++regressions;
+			std::cout << "  " << r.key() << ": " << it->second << " -> " << r.ms.median << " ms ("
+				<< std::showpos << change << std::noshowpos << "%) " << verdict << "\n";
+		}
+		return regressions;
+	}
+
+public:
+	Suite(const std::string& name, int argc = 0, char** argv = nullptr)
+		: suite_name(name), opts(argc, argv) {
+		warmup = (int)opts.get_int("warmup", 1);
+		trials = std::max(1, (int)opts.get_int("trials", 5));
+	}
+
+	const Options& options() const { return opts; }
+
+	// Called before every warmup and trial run, outside the timed region.
+	void set_sync(std::function<void()> fn) { sync = std::move(fn); }
+
+	// Only the reporting process prints and writes files (e.g. MPI rank 0).
+	void set_reporting(bool value) { reporting = value; }
+
+	template<typename F>
+	Result run(const std::string& name, const std::string& case_params, Throughput work, F&& body) {
+		for (int i = 0; i < warmup; ++i) {
+			if (sync) sync();
+			body();
+		}
+
+		std::vector<double> samples;
+		samples.reserve(trials);
+		for (int i = 0; i < trials; ++i) {
+			if (sync) sync();
+			auto start = std::chrono::steady_clock::now();
+			body();
+			auto stop = std::chrono::steady_clock::now();
+			samples.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+		}
+
+		Result r;
+		r.name = name;
+		r.params = case_params;
+		r.trials = trials;
+		r.ms = summarize(samples);
+		r.work = work;
+		results.push_back(r);
+
+		if (reporting) {
+			std::ostringstream line;
+			line << std::fixed << std::setprecision(3) << r.key() << ": median " << r.ms.median
+				<< " ms (min " << r.ms.min << ", p90 " << r.ms.p90 << ", stddev " << r.ms.stddev << ")";
+			if (!r.work.unit.empty()) line << ", " << r.throughput() << " " << r.work.unit;
+			std::cout << line.str() << "\n";
+		}
+		return r;
+	}
+
+	const std::vector<Result>& all() const { return results; }
+
+	// Writes the requested outputs; the return value is meant for main().
+	int report() const {
+		if (!reporting) return 0;
+		if (opts.has("csv")) write_csv(opts.get_string("csv"));
+		if (opts.has("json")) write_json(opts.get_string("json"));
+		if (opts.has("compare")) {
+			int regressions = compare(opts.get_string("compare"), opts.get_double("threshold", 5.0));
+			std::cout << regressions << " regression(s)\n";
+			return regressions > 0 ? 1 : 0;
+		}
+		return 0;
+	}
+};
+
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+// C++20 coroutine tasks on the fixed ThreadPool.
+//
+//   pc::task<double> integrate_job(pc::ThreadPool& pool) {
+//       co_await pc::schedule(pool);          // continue on a pool worker
+//       co_return pc::integrate(pc::simd, pc::simpson, f, 0.0, 1.0, n);
+//   }
+//
+//   std::vector<pc::task<double>> jobs = ...;
+//   std::vector<double> results = pc::sync_wait(pc::when_all(std::move(jobs)));
+//
+// Tasks are lazy: nothing runs until the task is awaited. A task that waits
+// on another one gives its thread back instead of blocking it, so any
+// number of outstanding jobs share the pool's threads; the awaiting
+// coroutine is resumed on whichever thread finishes the last job it needs.
+// poll() suspends until a non-blocking check succeeds (MPI_Test, a file
+// read finishing) and lets the pool run other jobs in the meantime.
+//
+// Exceptions thrown inside a task are rethrown where its result is taken.
+// Only sync_wait() blocks; call it from threads outside the pool.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace pc {
+
+template<typename T = void>
+class task;
+
+namespace detail {
+
+struct promise_base {
+	std::coroutine_handle<> continuation = std::noop_coroutine();
+	std::exception_ptr error;
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	// Hand the thread straight to whoever awaited us.
+	struct final_awaiter {
+		bool await_ready() noexcept { return false; }
+		template<typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept { return h.promise().continuation; }
+		void await_resume() noexcept {}
+	};
+
+	final_awaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() { error = std::current_exception(); }
+};
+
+template<typename T>
+struct promise : promise_base {
+	std::optional<T> value;
+
+	task<T> get_return_object();
+	void return_value(T v) { value.emplace(std::move(v)); }
+
+	T take() {
+		if (error) std::rethrow_exception(error);
+		return std::move(*value);
+	}
+};
+
+template<>
+struct promise<void> : promise_base {
+	task<void> get_return_object();
+	void return_void() {}
+
+	void take() {
+		if (error) std::rethrow_exception(error);
+	}
+};
+
+// Fire-and-forget coroutine used to attach completion callbacks to tasks.
+struct detached {
+	struct promise_type {
+		detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+}
+
+template<typename T>
+class task {
+public:
+	using promise_type = detail::promise<T>;
+
+private:
+	std::coroutine_handle<promise_type> handle;
+
+	struct awaiter {
+		std::coroutine_handle<promise_type> h;
+		bool take_result;
+
+		bool await_ready() const noexcept { return !h || h.done(); }
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+			h.promise().continuation = awaiting;
+			return h;
+		}
+
+		T await_resume() {
+			if constexpr (std::is_void<T>::value) {
+				if (take_result) h.promise().take();
+			}
+			else {
+				return h.promise().take();
+			}
+		}
+	};
+
+public:
+	explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+	task(task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+	task& operator=(task&& other) noexcept {
+		if (this != &other) {
+			if (handle) handle.destroy();
+			handle = std::exchange(other.handle, {});
+		}
+		return *this;
+	}
+
+	~task() {
+		if (handle) handle.destroy();
+	}
+
+	task(const task&) = delete;
+	task& operator=(const task&) = delete;
+
+	awaiter operator co_await() noexcept { return awaiter{ handle, true }; }
+
+	// Runs the task to completion without taking its result, so a failed
+	// task does not throw here; result() does.
+	auto when_ready() noexcept {
+		struct ready_awaiter : awaiter {
+			void await_resume() noexcept {}
+		};
+		return ready_awaiter{ { handle, false } };
+	}
+
+	T result() { return handle.promise().take(); }
+};
+
+namespace detail {
+
+template<typename T>
+task<T> promise<T>::get_return_object() {
+	return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() {
+	return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+struct Countdown {
+	std::atomic<size_t> remaining{ 0 };
+	std::coroutine_handle<> parent;
+
+	bool arrive() { return remaining.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+};
+
+template<typename T>
+detached notify_when_ready(task<T>& t, Countdown& countdown) {
+	co_await t.when_ready();
+	if (countdown.arrive()) countdown.parent.resume();
+}
+
+// Starts every task and resumes the awaiting coroutine after the last one.
+template<typename T>
+struct all_ready {
+	std::vector<task<T>>& tasks;
+	Countdown countdown{};
+
+	bool await_ready() const noexcept { return tasks.empty(); }
+
+	bool await_suspend(std::coroutine_handle<> parent) {
+		countdown.remaining = tasks.size() + 1;
+		countdown.parent = parent;
+		for (auto& t : tasks) notify_when_ready(t, countdown);
+		return !countdown.arrive();
+	}
+
+	void await_resume() noexcept {}
+};
+
+}
+
+// Continues the awaiting coroutine on a pool worker.
+inline auto schedule(ThreadPool& pool) {
+	struct awaiter {
+		ThreadPool& pool;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h) { pool.post([h] { h.resume(); }); }
+		void await_resume() const noexcept {}
+	};
+	return awaiter{ pool };
+}
+
+// Suspends until ready() returns true. The check is re-queued behind the
+// pool's other work each time it fails, so waiting costs no thread. After
+// 16 misses in a row the worker yields before re-queueing, and after 32 it
+// sleeps for 1 us, doubling up to 1 ms, so a long wait with nothing else
+// queued does not keep a worker spinning at full CPU.
+template<typename F>
+auto poll(ThreadPool& pool, F ready) {
+	struct awaiter {
+		ThreadPool& pool;
+		F ready;
+		int misses = 0;
+
+		bool await_ready() { return ready(); }
+
+		void await_suspend(std::coroutine_handle<> h) { requeue(h); }
+
+		void requeue(std::coroutine_handle<> h) {
+			pool.post([this, h] {
+				if (ready()) {
+					h.resume();
+					return;
+				}
+				backoff();
+				requeue(h);
+			});
+		}
+
+		void backoff() {
+			++misses;
+			if (misses <= 16) return;
+			if (misses <= 32) std::this_thread::yield();
+			else std::this_thread::sleep_for(std::chrono::microseconds(1 << std::min(misses - 33, 10)));
+		}
+
+		void await_resume() const noexcept {}
+	};
+	return awaiter{ pool, std::move(ready), 0 };
+}
+
+// f() as a task on the pool.
+template<typename F>
+auto run_on(ThreadPool& pool, F f) -> task<decltype(f())> {
+	co_await schedule(pool);
+	co_return f();
+}
+
+template<typename T>
+task<std::vector<T>> when_all(std::vector<task<T>> tasks) {
+	co_await detail::all_ready<T>{ tasks };
+	std::vector<T> results;
+	results.reserve(tasks.size());
+	for (auto& t : tasks) results.push_back(t.result());
+	co_return results;
+}
+
+inline task<void> when_all(std::vector<task<void>> tasks) {
+	co_await detail::all_ready<void>{ tasks };
+	for (auto& t : tasks) t.result();
+}
+
+template<typename T>
+T sync_wait(task<T> t) {
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool done = false;
+
+	auto signal = [&]() -> detail::detached {
+		co_await t.when_ready();
+		std::lock_guard<std::mutex> lock(mtx);
+		done = true;
+		cv.notify_one();
+	};
+	signal();
+
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&] { return done; });
+	return t.result();
+}
+
+}
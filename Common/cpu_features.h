@@ -0,0 +1,96 @@
+#pragma once
+
+// Run-time CPU feature detection for kernels that are compiled for a newer
+// instruction set than the rest of the program.
+//
+//   PC_TARGET("avx") void kernel(...);        // may use AVX intrinsics
+//   if (pc::cpu().avx) kernel(...);           // only called where supported
+//
+// GCC and Clang need the target attribute to accept the intrinsics without
+// -mavx; MSVC accepts them anywhere, so PC_TARGET expands to nothing there.
+// A feature that needs OS support for wider registers (AVX, AVX-512) is only
+// reported when XGETBV says the OS saves that register state.
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PC_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PC_TARGET(isa)
+#endif
+
+namespace pc {
+
+struct CpuFeatures {
+	bool sse41 = false;
+	bool avx = false;
+	bool avx2 = false;
+	bool fma = false;
+	bool f16c = false;
+	bool avx512f = false;
+	bool avx512bf16 = false;
+};
+
+namespace detail {
+
+inline void cpuid(unsigned leaf, unsigned sub, unsigned regs[4]) {
+	regs[0] = regs[1] = regs[2] = regs[3] = 0;
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, (int)leaf, (int)sub);
+	for (int i = 0; i < 4; ++i) regs[i] = (unsigned)r[i];
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	if (leaf <= __get_cpuid_max(leaf & 0x80000000u, nullptr)) __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#else
+	(void)leaf;
+	(void)sub;
+#endif
+}
+
+inline unsigned long long xgetbv0() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	unsigned lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+inline CpuFeatures detect_cpu() {
+	CpuFeatures f;
+	unsigned r1[4], r7[4], r71[4];
+	cpuid(1, 0, r1);
+	cpuid(7, 0, r7);
+	cpuid(7, 1, r71);
+
+	const bool osxsave = (r1[2] >> 27) & 1;
+	const unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+	const bool ymm = (xcr0 & 0x6) == 0x6;     // SSE and AVX state
+	const bool zmm = (xcr0 & 0xE6) == 0xE6;   // plus opmask and upper ZMM
+
+	f.sse41 = (r1[2] >> 19) & 1;
+	f.avx = ymm && ((r1[2] >> 28) & 1);
+	f.fma = f.avx && ((r1[2] >> 12) & 1);
+	f.f16c = f.avx && ((r1[2] >> 29) & 1);
+	f.avx2 = f.avx && ((r7[1] >> 5) & 1);
+	f.avx512f = zmm && ((r7[1] >> 16) & 1);
+	f.avx512bf16 = f.avx512f && ((r71[0] >> 5) & 1);
+	return f;
+}
+
+}
+
+inline const CpuFeatures& cpu() {
+	static const CpuFeatures features = detail::detect_cpu();
+	return features;
+}
+
+}
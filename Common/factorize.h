@@ -0,0 +1,260 @@
+#pragma once
+
+// Tiled LU (partial pivoting) and Cholesky factorizations on a TaskGraph,
+// plus the triangular solves that use them.
+//
+// The matrix is cut into tile x tile blocks and every block operation is a
+// task that declares the tiles it reads and writes:
+//   LU        GETRF on a column panel, LASWP+TRSM on the tiles right of it,
+//             LASWP on the finished tiles left of it, GEMM on the trailing
+//             submatrix
+//   Cholesky  POTRF on a diagonal tile, TRSM below it, SYRK/GEMM on the
+//             trailing submatrix
+// With Schedule::dag tasks start as soon as their tiles are ready, so the
+// panel of step k + 1 overlaps the trailing update of step k. With
+// Schedule::fork_join every stage ends in a barrier, the bulk-synchronous
+// equivalent of splitting each step over threads.
+//
+// Works on anything that exposes get_rows() and row(i) returning a pointer
+// to a contiguous row of a square matrix. Factors are stored in place, as in
+// LAPACK: L below the diagonal (unit diagonal for LU) and U on and above it.
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "task_graph.h"
+
+namespace pc {
+
+enum class Schedule {
+	dag,
+	fork_join
+};
+
+namespace tiles {
+
+inline int extent(int n, int tile, int t) { return std::min(tile, n - t * tile); }
+
+// GETRF on the column panel k: rows from the diagonal down. Pivot rows are
+// swapped inside the panel and recorded as global row indices.
+template<typename M>
+void getrf_panel(M& a, int n, int tile, int k, std::vector<int>& pivots) {
+	const int c0 = k * tile, width = extent(n, tile, k);
+	for (int c = c0; c < c0 + width; ++c) {
+		int p = c;
+		for (int r = c + 1; r < n; ++r) {
+			if (std::fabs(a.row(r)[c]) > std::fabs(a.row(p)[c])) p = r;
+		}
+		pivots[c] = p;
+		if (a.row(p)[c] == 0) throw std::runtime_error("matrix is singular");
+		if (p != c) {
+			for (int j = c0; j < c0 + width; ++j) std::swap(a.row(c)[j], a.row(p)[j]);
+		}
+
+		const auto inv = 1 / a.row(c)[c];
+		for (int r = c + 1; r < n; ++r) {
+			auto* row = a.row(r);
+			row[c] *= inv;
+			const auto l = row[c];
+			const auto* pivot_row = a.row(c);
+			for (int j = c + 1; j < c0 + width; ++j) row[j] -= l * pivot_row[j];
+		}
+	}
+}
+
+// Applies the row swaps of panel k to the columns of tile column j.
+template<typename M>
+void laswp(M& a, int n, int tile, int k, int j, const std::vector<int>& pivots) {
+	const int c0 = k * tile, j0 = j * tile, width = extent(n, tile, j);
+	for (int r = c0; r < c0 + extent(n, tile, k); ++r) {
+		int p = pivots[r];
+		if (p == r) continue;
+		auto* x = a.row(r) + j0;
+		auto* y = a.row(p) + j0;
+		for (int c = 0; c < width; ++c) std::swap(x[c], y[c]);
+	}
+}
+
+// A(k, j) = L(k, k)^-1 * A(k, j) with unit lower L.
+template<typename M>
+void trsm_lower_unit(M& a, int n, int tile, int k, int j) {
+	const int r0 = k * tile, j0 = j * tile, height = extent(n, tile, k), width = extent(n, tile, j);
+	for (int r = r0; r < r0 + height; ++r) {
+		auto* row = a.row(r) + j0;
+		for (int m = r0; m < r; ++m) {
+			const auto l = a.row(r)[m];
+			const auto* above = a.row(m) + j0;
+			for (int c = 0; c < width; ++c) row[c] -= l * above[c];
+		}
+	}
+}
+
+// A(i, j) -= A(i, k) * A(k, j)
+template<typename M>
+void gemm_nn(M& a, int n, int tile, int i, int j, int k) {
+	const int i0 = i * tile, j0 = j * tile, k0 = k * tile;
+	const int height = extent(n, tile, i), width = extent(n, tile, j), depth = extent(n, tile, k);
+	for (int r = i0; r < i0 + height; ++r) {
+		auto* row = a.row(r) + j0;
+		const auto* left = a.row(r) + k0;
+		for (int m = 0; m < depth; ++m) {
+			const auto l = left[m];
+			const auto* right = a.row(k0 + m) + j0;
+			for (int c = 0; c < width; ++c) row[c] -= l * right[c];
+		}
+	}
+}
+
+// Lower Cholesky of the diagonal tile k.
+template<typename M>
+void potrf(M& a, int n, int tile, int k) {
+	const int r0 = k * tile, size = extent(n, tile, k);
+	for (int c = r0; c < r0 + size; ++c) {
+		auto d = a.row(c)[c];
+		for (int m = r0; m < c; ++m) d -= a.row(c)[m] * a.row(c)[m];
+		if (!(d > 0)) throw std::runtime_error("matrix is not positive definite");
+		d = std::sqrt(d);
+		a.row(c)[c] = d;
+		for (int r = c + 1; r < r0 + size; ++r) {
+			auto s = a.row(r)[c];
+			for (int m = r0; m < c; ++m) s -= a.row(r)[m] * a.row(c)[m];
+			a.row(r)[c] = s / d;
+		}
+	}
+}
+
+// A(i, k) = A(i, k) * L(k, k)^-T
+template<typename M>
+void trsm_right_lower_t(M& a, int n, int tile, int i, int k) {
+	const int i0 = i * tile, k0 = k * tile, height = extent(n, tile, i), size = extent(n, tile, k);
+	for (int r = i0; r < i0 + height; ++r) {
+		auto* x = a.row(r) + k0;
+		for (int c = 0; c < size; ++c) {
+			const auto* l = a.row(k0 + c) + k0;
+			auto s = x[c];
+			for (int m = 0; m < c; ++m) s -= x[m] * l[m];
+			x[c] = s / l[c];
+		}
+	}
+}
+
+// A(i, j) -= A(i, k) * A(j, k)^T; with i == j only the lower half (SYRK).
+template<typename M>
+void gemm_nt(M& a, int n, int tile, int i, int j, int k) {
+	const int i0 = i * tile, j0 = j * tile, k0 = k * tile;
+	const int height = extent(n, tile, i), width = extent(n, tile, j), depth = extent(n, tile, k);
+	for (int r = 0; r < height; ++r) {
+		auto* row = a.row(i0 + r) + j0;
+		const auto* x = a.row(i0 + r) + k0;
+		const int last = i == j ? r + 1 : width;
+		for (int c = 0; c < last; ++c) {
+			const auto* y = a.row(j0 + c) + k0;
+			auto s = row[c];
+			for (int m = 0; m < depth; ++m) s -= x[m] * y[m];
+			row[c] = s;
+		}
+	}
+}
+
+}
+
+// pivots[r] is the row swapped with row r at step r, as in LAPACK's ipiv.
+template<typename M>
+void lu_factorize(ThreadPool& pool, M& a, std::vector<int>& pivots, int tile = 128, Schedule schedule = Schedule::dag) {
+	const int n = a.get_rows();
+	const int count = (n + tile - 1) / tile;
+	pivots.assign(n, 0);
+	auto key = [count](int i, int j) { return (TaskGraph::Key)i * count + j; };
+	const bool fork_join = schedule == Schedule::fork_join;
+
+	TaskGraph graph;
+	for (int k = 0; k < count; ++k) {
+		std::vector<TaskGraph::Key> panel;
+		for (int i = k; i < count; ++i) panel.push_back(key(i, k));
+		graph.add([&a, &pivots, n, tile, k] { tiles::getrf_panel(a, n, tile, k, pivots); }, {}, panel);
+		if (fork_join) graph.barrier();
+
+		for (int j = 0; j < count; ++j) {
+			if (j == k) continue;
+			std::vector<TaskGraph::Key> column;
+			for (int i = k; i < count; ++i) column.push_back(key(i, j));
+			graph.add([&a, &pivots, n, tile, k, j] {
+				tiles::laswp(a, n, tile, k, j, pivots);
+				if (j > k) tiles::trsm_lower_unit(a, n, tile, k, j);
+				}, { key(k, k) }, column);
+		}
+		if (fork_join) graph.barrier();
+
+		for (int i = k + 1; i < count; ++i) {
+			for (int j = k + 1; j < count; ++j) {
+				graph.add([&a, n, tile, i, j, k] { tiles::gemm_nn(a, n, tile, i, j, k); }, { key(i, k), key(k, j) }, { key(i, j) });
+			}
+		}
+		if (fork_join) graph.barrier();
+	}
+	graph.run(pool);
+}
+
+// Lower factor L with A = L * L^T; the strict upper triangle is left as is.
+template<typename M>
+void cholesky_factorize(ThreadPool& pool, M& a, int tile = 128, Schedule schedule = Schedule::dag) {
+	const int n = a.get_rows();
+	const int count = (n + tile - 1) / tile;
+	auto key = [count](int i, int j) { return (TaskGraph::Key)i * count + j; };
+	const bool fork_join = schedule == Schedule::fork_join;
+
+	TaskGraph graph;
+	for (int k = 0; k < count; ++k) {
+		graph.add([&a, n, tile, k] { tiles::potrf(a, n, tile, k); }, {}, { key(k, k) });
+		if (fork_join) graph.barrier();
+
+		for (int i = k + 1; i < count; ++i) {
+			graph.add([&a, n, tile, i, k] { tiles::trsm_right_lower_t(a, n, tile, i, k); }, { key(k, k) }, { key(i, k) });
+		}
+		if (fork_join) graph.barrier();
+
+		for (int i = k + 1; i < count; ++i) {
+			for (int j = k + 1; j <= i; ++j) {
+				graph.add([&a, n, tile, i, j, k] { tiles::gemm_nt(a, n, tile, i, j, k); }, { key(i, k), key(j, k) }, { key(i, j) });
+			}
+		}
+		if (fork_join) graph.barrier();
+	}
+	graph.run(pool);
+}
+
+// Solves A x = b in place from lu_factorize's output.
+template<typename M, typename T>
+void lu_solve(const M& lu, const std::vector<int>& pivots, std::vector<T>& b) {
+	const int n = lu.get_rows();
+	for (int r = 0; r < n; ++r) std::swap(b[r], b[pivots[r]]);
+	for (int r = 0; r < n; ++r) {
+		const auto* row = lu.row(r);
+		for (int c = 0; c < r; ++c) b[r] -= row[c] * b[c];
+	}
+	for (int r = n - 1; r >= 0; --r) {
+		const auto* row = lu.row(r);
+		for (int c = r + 1; c < n; ++c) b[r] -= row[c] * b[c];
+		b[r] /= row[r];
+	}
+}
+
+// Solves A x = b in place from cholesky_factorize's output.
+template<typename M, typename T>
+void cholesky_solve(const M& l, std::vector<T>& b) {
+	const int n = l.get_rows();
+	for (int r = 0; r < n; ++r) {
+		const auto* row = l.row(r);
+		for (int c = 0; c < r; ++c) b[r] -= row[c] * b[c];
+		b[r] /= row[r];
+	}
+	for (int r = n - 1; r >= 0; --r) {
+		b[r] /= l.row(r)[r];
+		for (int c = 0; c < r; ++c) b[c] -= l.row(r)[c] * b[r];
+	}
+}
+
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+// 16-bit floating-point storage types: IEEE half (fp16) and bfloat16.
+//
+// Both only store values; arithmetic happens in float through the implicit
+// conversions, and the gemm kernels widen whole rows to fp32 with
+// to_float() before accumulating in fp32. fp16 keeps 11 significant bits
+// over a range of +-65504, bf16 keeps 8 bits over the full float range.
+//
+// Bulk conversions (to_float, from_float) pick F16C for fp16 and AVX-512
+// BF16 for float -> bf16 at run time when the CPU has them, so the default
+// project settings (no /arch:AVX2) still get them; otherwise SSE2 or scalar
+// code. Single values use F16C only when the compiler targets it (-mf16c,
+// /arch:AVX2), since a feature check per element would cost more than the
+// conversion. Rounding is to nearest even everywhere.
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+
+#include "cpu_features.h"
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define PC_HAVE_F16C 1
+#endif
+
+// AVX-512 BF16 intrinsics under a target attribute need GCC 10 or Clang 9;
+// MSVC only gets them when compiling for that target.
+#if (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 10) || (defined(__clang__) && __clang_major__ >= 9) \
+	|| defined(__AVX512BF16__)
+#define PC_CAN_BF16 1
+#endif
+
+namespace pc {
+
+inline uint32_t float_bits(float f) {
+	uint32_t u;
+	std::memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+inline float bits_float(uint32_t u) {
+	float f;
+	std::memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+inline uint16_t float_to_half_bits(float f) {
+#ifdef PC_HAVE_F16C
+	return (uint16_t)_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+	uint32_t x = float_bits(f);
+	uint32_t sign = (x >> 16) & 0x8000u;
+	x &= 0x7FFFFFFFu;
+
+	if (x >= 0x47800000u) {
+		// Overflow to infinity; NaN stays a (quiet) NaN.
+		return (uint16_t)(sign | (x > 0x7F800000u ? 0x7E00u : 0x7C00u));
+	}
+	if (x < 0x38800000u) {
+		// Subnormal or zero: let the FPU do the rounding by adding 0.5.
+		uint32_t r = float_bits(bits_float(x) + 0.5f) - 0x3F000000u;
+		return (uint16_t)(sign | r);
+	}
+	uint32_t odd = (x >> 13) & 1u;
+	x += 0xC8000FFFu + odd;
+	return (uint16_t)(sign | (x >> 13));
+#endif
+}
+
+inline float half_bits_to_float(uint16_t h) {
+#ifdef PC_HAVE_F16C
+	return _cvtsh_ss(h);
+#else
+	uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+	uint32_t x = (uint32_t)(h & 0x7FFFu) << 13;
+	uint32_t exp = x & 0x0F800000u;
+	x += 0x38000000u;
+	if (exp == 0x0F800000u) {
+		x += 0x38000000u;
+	}
+	else if (exp == 0) {
+		x = float_bits(bits_float(x + 0x00800000u) - bits_float(0x38800000u));
+	}
+	return bits_float(x | sign);
+#endif
+}
+
+inline uint16_t float_to_bf16_bits(float f) {
+	uint32_t x = float_bits(f);
+	if ((x & 0x7FFFFFFFu) > 0x7F800000u) return (uint16_t)((x >> 16) | 0x40u);
+	x += 0x7FFFu + ((x >> 16) & 1u);
+	return (uint16_t)(x >> 16);
+}
+
+inline float bf16_bits_to_float(uint16_t b) {
+	return bits_float((uint32_t)b << 16);
+}
+
+struct half {
+	uint16_t bits = 0;
+
+	half() = default;
+	half(float f) : bits(float_to_half_bits(f)) {}
+	operator float() const { return half_bits_to_float(bits); }
+	half& operator+=(float x) { return *this = half(float(*this) + x); }
+};
+
+struct bfloat16 {
+	uint16_t bits = 0;
+
+	bfloat16() = default;
+	bfloat16(float f) : bits(float_to_bf16_bits(f)) {}
+	operator float() const { return bf16_bits_to_float(bits); }
+	bfloat16& operator+=(float x) { return *this = bfloat16(float(*this) + x); }
+};
+
+static_assert(sizeof(half) == 2 && sizeof(bfloat16) == 2, "16-bit storage types must be packed");
+
+namespace detail {
+
+// Whole blocks of 8 only; return how many elements were converted.
+PC_TARGET("avx,f16c") inline int to_float_f16c(const half* in, float* out, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(in + i))));
+	}
+	return i;
+}
+
+PC_TARGET("avx,f16c") inline int from_float_f16c(const float* in, half* out, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm_storeu_si128((__m128i*)(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+	}
+	return i;
+}
+
+#ifdef PC_CAN_BF16
+PC_TARGET("avx512f,avx512bf16") inline int from_float_bf16(const float* in, bfloat16* out, int n) {
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256bh packed = _mm512_cvtneps_pbh(_mm512_loadu_ps(in + i));
+		std::memcpy((void*)(out + i), &packed, sizeof(packed));
+	}
+	return i;
+}
+#endif
+
+}
+
+inline void to_float(const half* in, float* out, int n) {
+	int i = cpu().f16c ? detail::to_float_f16c(in, out, n) : 0;
+	for (; i < n; ++i) out[i] = float(in[i]);
+}
+
+inline void to_float(const bfloat16* in, float* out, int n) {
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i b = _mm_loadu_si128((const __m128i*)(in + i));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi16(zero, b));
+		_mm_storeu_si128((__m128i*)(out + i + 4), _mm_unpackhi_epi16(zero, b));
+	}
+	for (; i < n; ++i) out[i] = float(in[i]);
+}
+
+inline void from_float(const float* in, half* out, int n) {
+	int i = cpu().f16c ? detail::from_float_f16c(in, out, n) : 0;
+	for (; i < n; ++i) out[i] = half(in[i]);
+}
+
+inline void from_float(const float* in, bfloat16* out, int n) {
+	int i = 0;
+#ifdef PC_CAN_BF16
+	if (cpu().avx512bf16) i = detail::from_float_bf16(in, out, n);
+#endif
+	for (; i < n; ++i) out[i] = bfloat16(in[i]);
+}
+
+}
@@ -0,0 +1,412 @@
+#pragma once
+
+// Tiled on-disk matrix format, opened zero-copy through mmap /
+// MapViewOfFile, and an out-of-core multiply over such files.
+//
+// Layout: a 4 KiB header followed by square tiles stored tile-row by
+// tile-row. Every tile is tile x tile elements, row-major, zero-padded at
+// the matrix edges and rounded up to a 4 KiB boundary, so a tile is a whole
+// number of pages that can be prefetched or dropped on its own.
+//
+//   auto a = mf::MatrixView<double>::create("a.pcm", rows, cols, 256);
+//   a.at(i, j) = 1.0;                       // writes go straight to the file
+//   auto b = mf::MatrixView<double>::open("b.pcm");
+//   mf::multiply(pc::openmp(pc::simd), a, b, c);
+//
+// multiply() walks C tile by tile. While one pair of A/B tiles is being
+// multiplied, a reader thread that lives for the whole multiply copies the
+// next pair out of the mapping (taking the page faults there) into the
+// other of two buffers, and the pair after that is announced to the kernel
+// with madvise(MADV_WILLNEED) / PrefetchVirtualMemory, so disk reads
+// overlap the arithmetic. Errors are reported as std::runtime_error.
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "policy.h"
+
+namespace mf {
+
+const size_t header_size = 4096;
+const size_t tile_alignment = 4096;
+
+struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t element_type;
+	uint64_t rows;
+	uint64_t cols;
+	uint64_t tile;
+	uint64_t tile_bytes;
+};
+
+template<typename T> uint32_t element_type();
+template<> inline uint32_t element_type<double>() { return 1; }
+template<> inline uint32_t element_type<float>() { return 2; }
+
+enum class Access {
+	sequential,
+	will_need,
+	dont_need
+};
+
+class MappedFile {
+private:
+	char* base = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+
+	// Releases whatever has been acquired so far, so a constructor that
+	// fails halfway leaks no descriptor or handle.
+	void fail(const std::string& what, const std::string& path) {
+		close();
+		throw std::runtime_error(what + ": " + path);
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (base) UnmapViewOfFile(base);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (base) munmap(base, length);
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+#endif
+		base = nullptr;
+	}
+
+public:
+	// create_size > 0 creates (or truncates) the file with that size.
+	MappedFile(const std::string& path, size_t create_size = 0) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+			create_size > 0 ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) fail("cannot open", path);
+		LARGE_INTEGER size;
+		if (create_size > 0) {
+			size.QuadPart = (LONGLONG)create_size;
+			if (!SetFilePointerEx(file, size, NULL, FILE_BEGIN) || !SetEndOfFile(file)) fail("cannot resize", path);
+		}
+		else if (!GetFileSizeEx(file, &size)) {
+			fail("cannot stat", path);
+		}
+		length = (size_t)size.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+		if (mapping == NULL) fail("cannot map", path);
+		base = (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+		if (base == nullptr) fail("cannot map", path);
+#else
+		fd = ::open(path.c_str(), create_size > 0 ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+		if (fd < 0) fail("cannot open", path);
+		if (create_size > 0) {
+			if (ftruncate(fd, (off_t)create_size) != 0) fail("cannot resize", path);
+			length = create_size;
+		}
+		else {
+			struct stat st;
+			if (fstat(fd, &st) != 0) fail("cannot stat", path);
+			length = (size_t)st.st_size;
+		}
+		void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) fail("cannot map", path);
+		base = (char*)p;
+#endif
+	}
+
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	char* data() const { return base; }
+	size_t size() const { return length; }
+
+	// Paging hint for a byte range; a no-op where the OS has no equivalent.
+	void advise(size_t offset, size_t bytes, Access access) const {
+#ifdef _WIN32
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+		if (access == Access::will_need) {
+			WIN32_MEMORY_RANGE_ENTRY range{ base + offset, bytes };
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+		}
+#else
+		(void)offset; (void)bytes; (void)access;
+#endif
+#else
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		size_t begin = offset / page * page;
+		int advice = access == Access::sequential ? MADV_SEQUENTIAL
+			: access == Access::will_need ? MADV_WILLNEED : MADV_DONTNEED;
+		madvise(base + begin, offset + bytes - begin, advice);
+#endif
+	}
+
+	void flush() const {
+#ifdef _WIN32
+		FlushViewOfFile(base, 0);
+#else
+		msync(base, length, MS_SYNC);
+#endif
+	}
+};
+
+// A matrix file mapped into memory. Element access reads and writes the
+// mapping directly; nothing is loaded up front.
+template<typename T>
+class MatrixView {
+private:
+	std::unique_ptr<MappedFile> file;
+	int rows = 0, cols = 0, tile = 0;
+	int tile_rows = 0, tile_cols = 0;
+	size_t tile_bytes = 0;
+
+	explicit MatrixView(std::unique_ptr<MappedFile> mapped) : file(std::move(mapped)) {
+		FileHeader h;
+		if (file->size() < header_size) throw std::runtime_error("matrix file too short");
+		std::memcpy(&h, file->data(), sizeof(h));
+		if (std::memcmp(h.magic, "PCMATRIX", 8) != 0 || h.version != 1) throw std::runtime_error("not a matrix file");
+		if (h.element_type != element_type<T>()) throw std::runtime_error("matrix file has a different element type");
+		if (h.rows > INT_MAX || h.cols > INT_MAX) throw std::runtime_error("matrix file dimensions too large");
+		// tile_bytes >= tile * tile * sizeof(T), written so it cannot overflow.
+		if (h.tile == 0 || h.tile > INT_MAX || h.tile_bytes / sizeof(T) / h.tile < h.tile) {
+			throw std::runtime_error("matrix file has an invalid tile size");
+		}
+
+		rows = (int)h.rows;
+		cols = (int)h.cols;
+		tile = (int)h.tile;
+		tile_bytes = (size_t)h.tile_bytes;
+		tile_rows = (int)((h.rows + h.tile - 1) / h.tile);
+		tile_cols = (int)((h.cols + h.tile - 1) / h.tile);
+		const uint64_t tiles = (uint64_t)tile_rows * (uint64_t)tile_cols;
+		if (tiles > 0 && h.tile_bytes > (file->size() - header_size) / tiles) throw std::runtime_error("matrix file truncated");
+	}
+
+public:
+	static MatrixView create(const std::string& path, int rows, int cols, int tile = 256) {
+		size_t bytes = ((size_t)tile * tile * sizeof(T) + tile_alignment - 1) / tile_alignment * tile_alignment;
+		size_t tiles = (size_t)((rows + tile - 1) / tile) * ((cols + tile - 1) / tile);
+		std::unique_ptr<MappedFile> mapped(new MappedFile(path, header_size + tiles * bytes));
+
+		FileHeader h;
+		std::memset(&h, 0, sizeof(h));
+		std::memcpy(h.magic, "PCMATRIX", 8);
+		h.version = 1;
+		h.element_type = element_type<T>();
+		h.rows = (uint64_t)rows;
+		h.cols = (uint64_t)cols;
+		h.tile = (uint64_t)tile;
+		h.tile_bytes = (uint64_t)bytes;
+		std::memcpy(mapped->data(), &h, sizeof(h));
+		return MatrixView(std::move(mapped));
+	}
+
+	static MatrixView open(const std::string& path) {
+		return MatrixView(std::unique_ptr<MappedFile>(new MappedFile(path)));
+	}
+
+	int get_rows() const { return rows; }
+	int get_cols() const { return cols; }
+	int get_tile() const { return tile; }
+	int get_tile_rows() const { return tile_rows; }
+	int get_tile_cols() const { return tile_cols; }
+
+	size_t tile_offset(int ti, int tj) const {
+		return header_size + ((size_t)ti * tile_cols + tj) * tile_bytes;
+	}
+
+	// tile x tile elements, row-major, zero-padded past the matrix edge.
+	T* tile_data(int ti, int tj) const { return (T*)(file->data() + tile_offset(ti, tj)); }
+
+	T& at(int i, int j) const { return tile_data(i / tile, j / tile)[(i % tile) * tile + j % tile]; }
+
+	void advise_tile(int ti, int tj, Access access) const {
+		file->advise(tile_offset(ti, tj), (size_t)tile * tile * sizeof(T), access);
+	}
+
+	void flush() const { file->flush(); }
+};
+
+// Copies between a mapped file and anything with get_rows()/get_cols()/row(i).
+template<typename T, typename M>
+void store(const M& m, MatrixView<T>& view) {
+	for (int i = 0; i < m.get_rows(); ++i) {
+		for (int j = 0; j < m.get_cols(); ++j) view.at(i, j) = T(m.row(i)[j]);
+	}
+}
+
+template<typename T, typename M>
+void load(const MatrixView<T>& view, M& m) {
+	for (int i = 0; i < view.get_rows(); ++i) {
+		for (int j = 0; j < view.get_cols(); ++j) m.row(i)[j] = view.at(i, j);
+	}
+}
+
+// A square tile in a plain buffer, shaped for pc::gemm.
+template<typename T>
+struct TileRef {
+	T* data;
+	int n;
+
+	int get_rows() const { return n; }
+	int get_cols() const { return n; }
+	T* row(int i) const { return data + (size_t)i * n; }
+};
+
+namespace detail {
+
+// Two buffer slots filled by one reader thread, at most two jobs ahead of
+// the consumer. fetch(job, a, b) fills a slot; jobs run in order 0, 1, ...
+template<typename T>
+class TileReader {
+private:
+	std::vector<T> a_buffer[2], b_buffer[2];
+	std::mutex mtx;
+	std::condition_variable cv;
+	long long fetched = 0, released = 0;
+	bool stopping = false;
+	std::thread reader;
+
+public:
+	template<typename Fetch>
+	TileReader(size_t elements, long long jobs, Fetch fetch) {
+		for (int s = 0; s < 2; ++s) {
+			a_buffer[s].resize(elements);
+			b_buffer[s].resize(elements);
+		}
+		reader = std::thread([this, jobs, fetch] {
+			for (long long job = 0; job < jobs; ++job) {
+				{
+					std::unique_lock<std::mutex> lock(mtx);
+					cv.wait(lock, [&] { return stopping || job - released < 2; });
+					if (stopping) return;
+				}
+				const int slot = (int)(job % 2);
+				fetch(job, a_buffer[slot].data(), b_buffer[slot].data());
+				{
+					std::lock_guard<std::mutex> lock(mtx);
+					fetched = job + 1;
+				}
+				cv.notify_all();
+			}
+		});
+	}
+
+	~TileReader() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopping = true;
+		}
+		cv.notify_all();
+		reader.join();
+	}
+
+	TileReader(const TileReader&) = delete;
+	TileReader& operator=(const TileReader&) = delete;
+
+	// Waits until job has been fetched and returns its slot.
+	int acquire(long long job) {
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [&] { return fetched > job; });
+		return (int)(job % 2);
+	}
+
+	// The consumer is done with job's slot; the reader may refill it.
+	void release(long long job) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			released = job + 1;
+		}
+		cv.notify_all();
+	}
+
+	T* a(int slot) { return a_buffer[slot].data(); }
+	T* b(int slot) { return b_buffer[slot].data(); }
+};
+
+}
+
+// C = A * B out of core. All three files must share the tile size; the
+// policy parallelises the multiplication of each tile pair.
+template<typename Policy, typename T>
+void multiply(const Policy& policy, const MatrixView<T>& a, const MatrixView<T>& b, MatrixView<T>& c) {
+	if (a.get_cols() != b.get_rows() || c.get_rows() != a.get_rows() || c.get_cols() != b.get_cols()) {
+		throw std::runtime_error("matrix dimensions do not match");
+	}
+	if (a.get_tile() != b.get_tile() || a.get_tile() != c.get_tile()) {
+		throw std::runtime_error("matrix files use different tile sizes");
+	}
+
+	const int tile = a.get_tile();
+	const int inner_tiles = a.get_tile_cols();
+	const size_t elements = (size_t)tile * tile;
+
+	std::vector<T> product(elements), sum(elements);
+
+	// Job (ti * tile_cols + tj) * inner_tiles + k is the tile pair A(ti, k), B(k, tj).
+	const int tile_cols = c.get_tile_cols();
+	const long long jobs = (long long)c.get_tile_rows() * tile_cols * inner_tiles;
+	detail::TileReader<T> reader(elements, jobs, [&a, &b, tile_cols, inner_tiles, elements](long long job, T* a_out, T* b_out) {
+		const int k = (int)(job % inner_tiles);
+		const long long pair = job / inner_tiles;
+		const int ti = (int)(pair / tile_cols), tj = (int)(pair % tile_cols);
+		std::memcpy(a_out, a.tile_data(ti, k), elements * sizeof(T));
+		std::memcpy(b_out, b.tile_data(k, tj), elements * sizeof(T));
+	});
+
+	long long job = 0;
+	for (int ti = 0; ti < c.get_tile_rows(); ++ti) {
+		for (int tj = 0; tj < tile_cols; ++tj) {
+			std::fill(sum.begin(), sum.end(), T(0));
+
+			for (int k = 0; k < inner_tiles; ++k, ++job) {
+				if (k + 2 < inner_tiles) {
+					a.advise_tile(ti, k + 2, Access::will_need);
+					b.advise_tile(k + 2, tj, Access::will_need);
+				}
+
+				const int slot = reader.acquire(job);
+				TileRef<T> ta{ reader.a(slot), tile };
+				TileRef<T> tb{ reader.b(slot), tile };
+				TileRef<T> tp{ product.data(), tile };
+				pc::gemm(policy, ta, tb, tp);
+				reader.release(job);
+				for (size_t e = 0; e < elements; ++e) sum[e] += product[e];
+			}
+
+			std::memcpy(c.tile_data(ti, tj), sum.data(), elements * sizeof(T));
+		}
+	}
+}
+
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+// Node-aware MPI: one copy of read-only data per node and hierarchical
+// reductions.
+//
+//   pc::NodeComm nodes(MPI_COMM_WORLD);
+//   pc::SharedArray<float> table(nodes, n);                  // one copy per node
+//   table.fill([&](long long i) { return f(a + i * h); });   // node ranks fill slices
+//   pc::NodeReducer<double> reducer(nodes);
+//   double s = pc::integrate(pc::node_mpi(reducer, pc::simd), pc::simpson, f, a, b, n);
+//
+// NodeComm splits a communicator with MPI_Comm_split_type into the ranks
+// that share memory (node) and a communicator of the first rank of every
+// node (leaders). SharedArray keeps its elements in an
+// MPI_Win_allocate_shared window owned by the node leader; the other ranks
+// map the same memory through MPI_Win_shared_query, so a node holds one copy
+// instead of one per rank. Writes become visible to the rest of the node at
+// the next sync().
+//
+// NodeReducer sums values hierarchically: every rank writes its value into a
+// shared slot, the leader adds the node's slots in rank order, the leaders
+// combine with MPI_Allreduce and the result is read back from shared memory.
+// Only one value per node crosses the network. node_mpi() splits ranges like
+// mpi() but combines the pieces through a NodeReducer.
+//
+// Constructors, destructors, fill(), broadcast(), sync() and reductions are
+// collective over the communicator the NodeComm was built from (sync() over
+// the node).
+
+#include <mpi.h>
+#include <algorithm>
+#include <cstddef>
+
+#include "policy.h"
+
+namespace pc {
+
+template<typename T> MPI_Datatype mpi_datatype();
+template<> inline MPI_Datatype mpi_datatype<int>() { return MPI_INT; }
+template<> inline MPI_Datatype mpi_datatype<long long>() { return MPI_LONG_LONG; }
+template<> inline MPI_Datatype mpi_datatype<float>() { return MPI_FLOAT; }
+template<> inline MPI_Datatype mpi_datatype<double>() { return MPI_DOUBLE; }
+
+struct NodeComm {
+	MPI_Comm comm;
+	MPI_Comm node = MPI_COMM_NULL;
+	MPI_Comm leaders = MPI_COMM_NULL;    // MPI_COMM_NULL on non-leaders
+	int rank = 0, size = 1;              // in comm
+	int node_rank = 0, node_size = 1;    // in node
+	int node_index = 0, node_count = 1;  // in leaders
+
+	explicit NodeComm(MPI_Comm split = MPI_COMM_WORLD) : comm(split) {
+		MPI_Comm_rank(comm, &rank);
+		MPI_Comm_size(comm, &size);
+		MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+		MPI_Comm_rank(node, &node_rank);
+		MPI_Comm_size(node, &node_size);
+
+		// Ranks keep their order, so rank 0 of comm leads node 0.
+		MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders);
+		int ids[2] = { 0, 1 };
+		if (leaders != MPI_COMM_NULL) {
+			MPI_Comm_rank(leaders, &ids[0]);
+			MPI_Comm_size(leaders, &ids[1]);
+		}
+		MPI_Bcast(ids, 2, MPI_INT, 0, node);
+		node_index = ids[0];
+		node_count = ids[1];
+	}
+
+	~NodeComm() {
+		if (leaders != MPI_COMM_NULL) MPI_Comm_free(&leaders);
+		MPI_Comm_free(&node);
+	}
+
+	bool leader() const { return node_rank == 0; }
+
+	NodeComm(const NodeComm&) = delete;
+	NodeComm& operator=(const NodeComm&) = delete;
+};
+
+template<typename T>
+class SharedArray {
+private:
+	const NodeComm& nodes;
+	MPI_Win win = MPI_WIN_NULL;
+	T* base = nullptr;
+	size_t count;
+
+public:
+	SharedArray(const NodeComm& node_comm, size_t n) : nodes(node_comm), count(n) {
+		MPI_Aint bytes = nodes.leader() ? (MPI_Aint)(n * sizeof(T)) : 0;
+		void* ptr = nullptr;
+		MPI_Win_allocate_shared(bytes, (int)sizeof(T), MPI_INFO_NULL, nodes.node, &ptr, &win);
+		MPI_Aint leader_bytes;
+		int unit;
+		MPI_Win_shared_query(win, 0, &leader_bytes, &unit, &ptr);
+		base = static_cast<T*>(ptr);
+		// One passive epoch for the whole lifetime; sync() orders the accesses.
+		MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+	}
+
+	~SharedArray() {
+		MPI_Win_unlock_all(win);
+		MPI_Win_free(&win);
+	}
+
+	T* data() { return base; }
+	const T* data() const { return base; }
+	size_t size() const { return count; }
+	T& operator[](size_t i) { return base[i]; }
+	const T& operator[](size_t i) const { return base[i]; }
+
+	// Makes every node rank's writes visible to the others.
+	void sync() {
+		MPI_Win_sync(win);
+		MPI_Barrier(nodes.node);
+		MPI_Win_sync(win);
+	}
+
+	// data[i] = f(i); every node rank fills a contiguous slice.
+	template<typename F>
+	void fill(F f) {
+		long long b, e;
+		split_range(0, (long long)count, nodes.node_size, nodes.node_rank, b, e);
+		for (long long i = b; i < e; ++i) base[i] = f(i);
+		sync();
+	}
+
+	// Copies the array of comm rank 0 to the other nodes; leaders receive
+	// straight into shared memory.
+	void broadcast() {
+		if (nodes.leaders != MPI_COMM_NULL && nodes.node_count > 1) {
+			char* bytes = reinterpret_cast<char*>(base);
+			const size_t total = count * sizeof(T), chunk = size_t(1) << 30;
+			for (size_t off = 0; off < total; off += chunk) {
+				MPI_Bcast(bytes + off, (int)std::min(chunk, total - off), MPI_BYTE, 0, nodes.leaders);
+			}
+		}
+		sync();
+	}
+
+	SharedArray(const SharedArray&) = delete;
+	SharedArray& operator=(const SharedArray&) = delete;
+};
+
+// Element-wise sums of width values over all ranks of a NodeComm.
+template<typename T>
+class NodeReducer {
+private:
+	const NodeComm& nodes;
+	int width;
+	SharedArray<T> slots;    // node_size partials, then the result
+
+public:
+	explicit NodeReducer(const NodeComm& node_comm, int w = 1)
+		: nodes(node_comm), width(w), slots(node_comm, (size_t)(node_comm.node_size + 1) * w) {}
+
+	void allreduce(const T* local, T* result) {
+		std::copy(local, local + width, slots.data() + (size_t)nodes.node_rank * width);
+		slots.sync();
+
+		T* total = slots.data() + (size_t)nodes.node_size * width;
+		if (nodes.leader()) {
+			for (int j = 0; j < width; ++j) {
+				T sum = T();
+				for (int r = 0; r < nodes.node_size; ++r) sum += slots[(size_t)r * width + j];
+				total[j] = sum;
+			}
+			if (nodes.node_count > 1) MPI_Allreduce(MPI_IN_PLACE, total, width, mpi_datatype<T>(), MPI_SUM, nodes.leaders);
+		}
+		slots.sync();
+		std::copy(total, total + width, result);
+	}
+
+	T allreduce(T local) {
+		T result;
+		allreduce(&local, &result);
+		return result;
+	}
+
+	const NodeComm& comm() const { return nodes; }
+};
+
+template<typename T, typename Inner>
+struct node_mpi_policy {
+	NodeReducer<T>* reducer;
+	Inner inner;
+};
+
+template<typename T, typename Inner = seq_policy>
+node_mpi_policy<T, Inner> node_mpi(NodeReducer<T>& reducer, Inner inner = Inner()) {
+	return node_mpi_policy<T, Inner>{ &reducer, inner };
+}
+
+// Every rank ends up with the combined result.
+template<typename R, typename T, typename Inner, typename Kernel>
+R run_range(const node_mpi_policy<T, Inner>& p, long long begin, long long end, Kernel& kernel) {
+	const NodeComm& nodes = p.reducer->comm();
+	long long b, e;
+	split_range(begin, end, nodes.size, nodes.rank, b, e);
+	R local = run_range<R>(p.inner, b, e, kernel);
+	return R(p.reducer->allreduce(T(local)));
+}
+
+}
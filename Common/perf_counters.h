@@ -0,0 +1,321 @@
+#pragma once
+
+// Scoped hardware performance-counter regions.
+//
+//   {
+//       perf::Region region("multiply_parallel", flops);
+//       ... kernel ...
+//   }
+//   perf::report();
+//
+// On Linux every thread lazily opens its own perf_event_open counters
+// (cycles, instructions, LLC misses, branch misses, vector FP instructions).
+// If the kernel refuses (perf_event_paranoid, containers) or on other
+// platforms the counters are simply missing: regions still record wall time
+// and the caller-supplied flop counts, and the report prints "n/a".
+//
+// Derived metrics:
+//   IPC                   instructions / cycles
+//   arithmetic intensity  flops / (LLC misses * 64 bytes)
+//   roofline fraction     achieved GFLOP/s / min(peak GFLOP/s, AI * peak GB/s)
+// Peaks come from set_machine_peaks() or the PARACOMP_PEAK_GFLOPS and
+// PARACOMP_PEAK_GBS environment variables.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#if defined(__linux__)
+#include <fstream>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perf {
+
+enum Counter {
+	cycles,
+	instructions,
+	llc_misses,
+	branch_misses,
+	vector_fp_ops,
+	counter_count
+};
+
+inline const char* counter_name(int c) {
+	static const char* names[counter_count] = {
+		"cycles", "instructions", "llc_misses", "branch_misses", "vector_fp_ops"
+	};
+	return names[c];
+}
+
+struct Counts {
+	uint64_t value[counter_count] = {};
+	bool valid[counter_count] = {};
+	double seconds = 0.0;
+	double flops = 0.0;
+	uint64_t calls = 0;
+
+	// A sum is only valid when every sample in it is: a single unread
+	// sample would make the total an undercount.
+	void add(const Counts& other) {
+		bool first = calls == 0;
+		for (int c = 0; c < counter_count; ++c) {
+			value[c] += other.value[c];
+			valid[c] = first ? other.valid[c] : valid[c] && other.valid[c];
+		}
+		seconds += other.seconds;
+		flops += other.flops;
+		calls += other.calls;
+	}
+
+	double ipc() const {
+		return valid[cycles] && valid[instructions] && value[cycles] > 0
+			? double(value[instructions]) / value[cycles] : -1.0;
+	}
+
+	double dram_bytes() const { return valid[llc_misses] ? double(value[llc_misses]) * 64.0 : -1.0; }
+
+	double arithmetic_intensity() const {
+		double bytes = dram_bytes();
+		return flops > 0.0 && bytes > 0.0 ? flops / bytes : -1.0;
+	}
+
+	double gflops() const { return seconds > 0.0 ? flops / seconds / 1e9 : 0.0; }
+};
+
+struct MachinePeaks {
+	double gflops = 0.0;
+	double gbs = 0.0;
+};
+
+inline MachinePeaks& machine_peaks() {
+	static MachinePeaks peaks = [] {
+		MachinePeaks p;
+		if (const char* v = std::getenv("PARACOMP_PEAK_GFLOPS")) p.gflops = std::atof(v);
+		if (const char* v = std::getenv("PARACOMP_PEAK_GBS")) p.gbs = std::atof(v);
+		return p;
+	}();
+	return peaks;
+}
+
+inline void set_machine_peaks(double gflops, double gbs) {
+	machine_peaks().gflops = gflops;
+	machine_peaks().gbs = gbs;
+}
+
+inline double roofline_fraction(const Counts& c) {
+	const MachinePeaks& peaks = machine_peaks();
+	double ai = c.arithmetic_intensity();
+	if (peaks.gflops <= 0.0 || peaks.gbs <= 0.0 || ai <= 0.0) return -1.0;
+	double attainable = std::min(peaks.gflops, ai * peaks.gbs);
+	return c.gflops() / attainable;
+}
+
+#if defined(__linux__)
+
+// Raw event for retired packed FP instructions. The default is Intel's
+// FP_ARITH_INST_RETIRED (all packed widths); other vendors need the
+// PARACOMP_PERF_FP_RAW environment variable (hex config) to get this counter.
+inline bool vector_fp_event(uint64_t& config) {
+	if (const char* v = std::getenv("PARACOMP_PERF_FP_RAW")) {
+		config = std::strtoull(v, nullptr, 16);
+		return config != 0;
+	}
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(cpuinfo, line)) {
+		if (line.compare(0, 9, "vendor_id") == 0) {
+			if (line.find("GenuineIntel") == std::string::npos) return false;
+			config = 0xC7 | (0xFCull << 8);
+			return true;
+		}
+	}
+	return false;
+}
+
+class ThreadCounters {
+private:
+	int fds[counter_count];
+
+	static int open_counter(uint32_t type, uint64_t config) {
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+public:
+	ThreadCounters() {
+		fds[cycles] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		fds[instructions] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		fds[llc_misses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		fds[branch_misses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+		uint64_t fp_config = 0;
+		fds[vector_fp_ops] = vector_fp_event(fp_config) ? open_counter(PERF_TYPE_RAW, fp_config) : -1;
+	}
+
+	~ThreadCounters() {
+		for (int fd : fds) {
+			if (fd >= 0) close(fd);
+		}
+	}
+
+	ThreadCounters(const ThreadCounters&) = delete;
+	ThreadCounters& operator=(const ThreadCounters&) = delete;
+
+	// Counter values scaled for multiplexing.
+	void read_all(Counts& out) const {
+		for (int c = 0; c < counter_count; ++c) {
+			uint64_t data[3];
+			out.valid[c] = fds[c] >= 0 && ::read(fds[c], data, sizeof(data)) == (ssize_t)sizeof(data);
+			out.value[c] = out.valid[c] && data[2] > 0
+				? (uint64_t)((double)data[0] * data[1] / data[2]) : 0;
+		}
+	}
+};
+
+#else
+
+class ThreadCounters {
+public:
+	void read_all(Counts& out) const {
+		for (int c = 0; c < counter_count; ++c) out.valid[c] = false;
+	}
+};
+
+#endif
+
+inline ThreadCounters& thread_counters() {
+	thread_local ThreadCounters counters;
+	return counters;
+}
+
+inline int thread_index() {
+	static std::atomic<int> next{ 0 };
+	thread_local int index = next++;
+	return index;
+}
+
+class Registry {
+private:
+	std::mutex mtx;
+	std::map<std::pair<std::string, int>, Counts> regions;
+
+public:
+	void add(const std::string& name, int thread, const Counts& counts) {
+		std::lock_guard<std::mutex> lock(mtx);
+		regions[std::make_pair(name, thread)].add(counts);
+	}
+
+	std::map<std::pair<std::string, int>, Counts> snapshot() {
+		std::lock_guard<std::mutex> lock(mtx);
+		return regions;
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(mtx);
+		regions.clear();
+	}
+};
+
+inline Registry& registry() {
+	static Registry r;
+	return r;
+}
+
+// Counts everything the calling thread does between construction and
+// destruction. flops is the useful work this thread does inside the region;
+// worker is the logical thread index to report under (short-lived threads
+// would otherwise each get a fresh index).
+class Region {
+private:
+	std::string name;
+	double flops;
+	int worker;
+	Counts start;
+	std::chrono::steady_clock::time_point start_time;
+
+public:
+	explicit Region(std::string region_name, double region_flops = 0.0, int region_worker = -1)
+		: name(std::move(region_name)), flops(region_flops),
+		worker(region_worker >= 0 ? region_worker : thread_index()) {
+		thread_counters().read_all(start);
+		start_time = std::chrono::steady_clock::now();
+	}
+
+	~Region() {
+		auto stop_time = std::chrono::steady_clock::now();
+		Counts stop;
+		thread_counters().read_all(stop);
+		for (int c = 0; c < counter_count; ++c) {
+			stop.valid[c] = stop.valid[c] && start.valid[c];
+			stop.value[c] = stop.valid[c] ? stop.value[c] - start.value[c] : 0;
+		}
+		stop.seconds = std::chrono::duration<double>(stop_time - start_time).count();
+		stop.flops = flops;
+		stop.calls = 1;
+		registry().add(name, worker, stop);
+	}
+
+	void add_flops(double extra) { flops += extra; }
+
+	Region(const Region&) = delete;
+	Region& operator=(const Region&) = delete;
+};
+
+inline std::string format_metric(double v, int precision = 3) {
+	if (v < 0.0) return "n/a";
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(precision) << v;
+	return out.str();
+}
+
+inline void print_counts(std::ostream& out, const std::string& label, const Counts& c) {
+	out << label << ": calls " << c.calls << ", time " << format_metric(c.seconds * 1e3) << " ms";
+	for (int k = 0; k < counter_count; ++k) {
+		out << ", " << counter_name(k) << " " << (c.valid[k] ? std::to_string(c.value[k]) : std::string("n/a"));
+	}
+	out << "\n    IPC " << format_metric(c.ipc())
+		<< ", GFLOP/s " << format_metric(c.flops > 0.0 ? c.gflops() : -1.0)
+		<< ", AI " << format_metric(c.arithmetic_intensity()) << " flop/byte"
+		<< ", roofline " << format_metric(roofline_fraction(c) * 100.0, 1) << "%\n";
+}
+
+// Per-region totals followed by the per-thread breakdown. Times are summed
+// over threads, so the region GFLOP/s is per-thread-second.
+inline void report(std::ostream& out = std::cout, bool per_thread = true) {
+	auto regions = registry().snapshot();
+	if (regions.empty()) return;
+
+	std::map<std::string, Counts> totals;
+	for (const auto& r : regions) totals[r.first.first].add(r.second);
+
+	out << "\n=== Performance counters ===\n";
+	for (const auto& t : totals) {
+		print_counts(out, t.first, t.second);
+		if (!per_thread) continue;
+		for (const auto& r : regions) {
+			if (r.first.first != t.first) continue;
+			print_counts(out, "  thread " + std::to_string(r.first.second), r.second);
+		}
+	}
+}
+
+}
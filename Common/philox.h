@@ -0,0 +1,177 @@
+#pragma once
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al., SC'11).
+//
+// Every output is a pure function of (seed, stream, counter), so any thread
+// or MPI rank can produce any part of a sequence without generating what
+// comes before it:
+//
+//   rng::Philox4x32 gen(seed);
+//   rng::uniform_real(gen, first, out, count, lo, hi);   // elements first..first+count-1
+//
+// Splitting a fill across workers by element offset therefore gives the
+// same numbers whatever the worker count. Different streams are independent
+// sequences for the same seed.
+//
+// blocks4() runs four counters through the rounds at once with SSE2; the
+// uniform_* helpers use it for everything but the unaligned head and tail.
+
+#include <emmintrin.h>
+#include <cstdint>
+
+namespace rng {
+
+struct Block {
+	uint32_t v[4];
+};
+
+class Philox4x32 {
+private:
+	static const uint32_t M0 = 0xD2511F53u;
+	static const uint32_t M1 = 0xCD9E8D57u;
+	static const uint32_t W0 = 0x9E3779B9u;
+	static const uint32_t W1 = 0xBB67AE85u;
+	static const int rounds = 10;
+
+	uint32_t key[2];
+	uint32_t stream_lo, stream_hi;
+
+	static void mulhilo(uint32_t m, uint32_t x, uint32_t& hi, uint32_t& lo) {
+		uint64_t product = (uint64_t)m * x;
+		hi = (uint32_t)(product >> 32);
+		lo = (uint32_t)product;
+	}
+
+	// Four 32x32->64 multiplies by a constant, split into high and low words.
+	static void mulhilo4(__m128i m, __m128i x, __m128i& hi, __m128i& lo) {
+		__m128i even = _mm_mul_epu32(x, m);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), m);
+		lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+		hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 3, 1)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 3, 1)));
+	}
+
+public:
+	explicit Philox4x32(uint64_t seed, uint64_t stream = 0)
+		: key{ (uint32_t)seed, (uint32_t)(seed >> 32) },
+		stream_lo((uint32_t)stream), stream_hi((uint32_t)(stream >> 32)) {}
+
+	Block block(uint64_t counter) const {
+		uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32), c2 = stream_lo, c3 = stream_hi;
+		uint32_t k0 = key[0], k1 = key[1];
+		for (int r = 0; r < rounds; ++r) {
+			uint32_t hi0, lo0, hi1, lo1;
+			mulhilo(M0, c0, hi0, lo0);
+			mulhilo(M1, c2, hi1, lo1);
+			c0 = hi1 ^ c1 ^ k0;
+			c1 = lo1;
+			c2 = hi0 ^ c3 ^ k1;
+			c3 = lo0;
+			k0 += W0;
+			k1 += W1;
+		}
+		return Block{ { c0, c1, c2, c3 } };
+	}
+
+	// block(counter + i) for i = 0..3.
+	void blocks4(uint64_t counter, Block out[4]) const {
+		uint64_t n1 = counter + 1, n2 = counter + 2, n3 = counter + 3;
+		__m128i c0 = _mm_set_epi32((int)(uint32_t)n3, (int)(uint32_t)n2, (int)(uint32_t)n1, (int)(uint32_t)counter);
+		__m128i c1 = _mm_set_epi32((int)(uint32_t)(n3 >> 32), (int)(uint32_t)(n2 >> 32), (int)(uint32_t)(n1 >> 32), (int)(uint32_t)(counter >> 32));
+		__m128i c2 = _mm_set1_epi32((int)stream_lo);
+		__m128i c3 = _mm_set1_epi32((int)stream_hi);
+		const __m128i m0 = _mm_set1_epi32((int)M0);
+		const __m128i m1 = _mm_set1_epi32((int)M1);
+		uint32_t k0 = key[0], k1 = key[1];
+
+		for (int r = 0; r < rounds; ++r) {
+			__m128i hi0, lo0, hi1, lo1;
+			mulhilo4(m0, c0, hi0, lo0);
+			mulhilo4(m1, c2, hi1, lo1);
+			c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int)k0));
+			c1 = lo1;
+			c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int)k1));
+			c3 = lo0;
+			k0 += W0;
+			k1 += W1;
+		}
+
+		alignas(16) uint32_t words[4][4];
+		_mm_store_si128((__m128i*)words[0], c0);
+		_mm_store_si128((__m128i*)words[1], c1);
+		_mm_store_si128((__m128i*)words[2], c2);
+		_mm_store_si128((__m128i*)words[3], c3);
+		for (int i = 0; i < 4; ++i) {
+			out[i] = Block{ { words[0][i], words[1][i], words[2][i], words[3][i] } };
+		}
+	}
+};
+
+// [0, 1) with 53 random bits from two words.
+inline double unit_double(uint32_t lo, uint32_t hi) {
+	return (double)((((uint64_t)hi << 32) | lo) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// [0, 1) with 24 random bits.
+inline float unit_float(uint32_t w) {
+	return (float)(w >> 8) * (1.0f / 16777216.0f);
+}
+
+// [lo, hi] by multiply-shift; the bias is below 2^-32 * range.
+inline int bounded_int(uint32_t w, int lo, int hi) {
+	uint64_t range = (uint64_t)((int64_t)hi - lo) + 1;
+	return (int)((int64_t)lo + (int64_t)(((uint64_t)w * range) >> 32));
+}
+
+// Element e of a real sequence is half e % 2 of block e / 2. Values are made
+// in double and rounded to T, so every element type sees the same sequence.
+template<typename T>
+void uniform_real(const Philox4x32& gen, uint64_t first, T* out, long long count, double lo, double hi) {
+	const double width = hi - lo;
+	long long i = 0;
+	uint64_t e = first;
+
+	if (i < count && e % 2 != 0) {
+		Block b = gen.block(e / 2);
+		out[i++] = T(lo + width * unit_double(b.v[2], b.v[3]));
+		++e;
+	}
+
+	Block b[4];
+	for (; i + 8 <= count; i += 8, e += 8) {
+		gen.blocks4(e / 2, b);
+		for (int l = 0; l < 4; ++l) {
+			out[i + 2 * l] = T(lo + width * unit_double(b[l].v[0], b[l].v[1]));
+			out[i + 2 * l + 1] = T(lo + width * unit_double(b[l].v[2], b[l].v[3]));
+		}
+	}
+
+	for (; i < count; ++i, ++e) {
+		Block t = gen.block(e / 2);
+		int half = (int)(e % 2) * 2;
+		out[i] = T(lo + width * unit_double(t.v[half], t.v[half + 1]));
+	}
+}
+
+// Element e of an int sequence is word e % 4 of block e / 4.
+inline void uniform_int(const Philox4x32& gen, uint64_t first, int* out, long long count, int lo, int hi) {
+	long long i = 0;
+	uint64_t e = first;
+
+	for (; i < count && e % 4 != 0; ++i, ++e) {
+		out[i] = bounded_int(gen.block(e / 4).v[e % 4], lo, hi);
+	}
+
+	Block b[4];
+	for (; i + 16 <= count; i += 16, e += 16) {
+		gen.blocks4(e / 4, b);
+		for (int l = 0; l < 4; ++l) {
+			for (int w = 0; w < 4; ++w) out[i + 4 * l + w] = bounded_int(b[l].v[w], lo, hi);
+		}
+	}
+
+	for (; i < count; ++i, ++e) {
+		out[i] = bounded_int(gen.block(e / 4).v[e % 4], lo, hi);
+	}
+}
+
+}
@@ -0,0 +1,878 @@
+#pragma once
+
+// Execution-policy front end for the lab algorithms.
+//
+//   pc::integrate(pc::simd, pc::simpson, f, a, b, n);
+//   pc::integrate(pc::threads(pool, pc::simd), pc::trapezoid, f, a, b, n);
+//   pc::gemm(pc::openmp(), a, b, c);
+//   pc::gemv(pc::threads(pool, pc::simd), a, x.data(), y.data());
+//   pc::integrate(pc::mpi(MPI_COMM_WORLD, pc::simd), pc::rectangle, f, a, b, n);
+//
+// Leaf policies (seq, simd, avx) run the kernel on one thread. threads(), openmp()
+// and mpi() split the index range and hand every piece to their inner
+// policy, so hybrids are built by nesting. All of this is resolved at compile
+// time; parse_policy() and with_policy() map a configuration string such as
+// "mpi+threads:8+simd" onto the same compile-time policies at run time.
+//
+// openmp() exists when the translation unit is compiled with OpenMP and mpi()
+// when <mpi.h> is included before this header.
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cpu_features.h"
+#include "float16.h"
+#include "thread_pool.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace pc {
+
+// ---- Policies ------------------------------------------------------------
+
+struct seq_policy {};
+struct simd_policy {};
+// 256-bit kernels compiled with PC_TARGET("avx"), for the kernels that
+// have them (gemm). Only use it when cpu().avx is set.
+struct avx_policy {};
+
+static const seq_policy seq{};
+static const simd_policy simd{};
+static const avx_policy avx{};
+
+template<typename Inner>
+struct threads_policy {
+	ThreadPool* pool;
+	Inner inner;
+	int chunks_per_thread;
+};
+
+template<typename Inner = seq_policy>
+threads_policy<Inner> threads(ThreadPool& pool, Inner inner = Inner(), int chunks_per_thread = 1) {
+	return threads_policy<Inner>{ &pool, inner, chunks_per_thread };
+}
+
+#ifdef _OPENMP
+template<typename Inner>
+struct openmp_policy {
+	int thread_count;
+	Inner inner;
+};
+
+template<typename Inner = seq_policy>
+openmp_policy<Inner> openmp(Inner inner = Inner(), int thread_count = 0) {
+	return openmp_policy<Inner>{ thread_count, inner };
+}
+#endif
+
+#ifdef MPI_VERSION
+template<typename Inner>
+struct mpi_policy {
+	MPI_Comm comm;
+	Inner inner;
+};
+
+template<typename Inner = seq_policy>
+mpi_policy<Inner> mpi(MPI_Comm comm, Inner inner = Inner()) {
+	return mpi_policy<Inner>{ comm, inner };
+}
+#endif
+
+// ---- Range decomposition -------------------------------------------------
+//
+// kernel(leaf, begin, end) returns the partial result for [begin, end);
+// partial results are combined with +. Splitting nodes hand each piece to
+// their inner policy and add the pieces up in index order.
+
+inline void split_range(long long begin, long long end, int parts, int part, long long& b, long long& e) {
+	long long n = end - begin;
+	b = begin + n * part / parts;
+	e = begin + n * (part + 1) / parts;
+}
+
+template<typename R, typename Kernel>
+R run_range(seq_policy p, long long begin, long long end, Kernel& kernel) {
+	return kernel(p, begin, end);
+}
+
+template<typename R, typename Kernel>
+R run_range(simd_policy p, long long begin, long long end, Kernel& kernel) {
+	return kernel(p, begin, end);
+}
+
+template<typename R, typename Kernel>
+R run_range(avx_policy p, long long begin, long long end, Kernel& kernel) {
+	return kernel(p, begin, end);
+}
+
+template<typename R, typename Inner, typename Kernel>
+R run_range(const threads_policy<Inner>& p, long long begin, long long end, Kernel& kernel) {
+	int parts = std::max(1, p.pool->size() * std::max(1, p.chunks_per_thread));
+	std::vector<R> partial(parts, R());
+	p.pool->parallel_for(parts, [&](int part) {
+		long long b, e;
+		split_range(begin, end, parts, part, b, e);
+		partial[part] = run_range<R>(p.inner, b, e, kernel);
+		});
+	R result = R();
+	for (const R& r : partial) result += r;
+	return result;
+}
+
+#ifdef _OPENMP
+template<typename R, typename Inner, typename Kernel>
+R run_range(const openmp_policy<Inner>& p, long long begin, long long end, Kernel& kernel) {
+	int parts = p.thread_count > 0 ? p.thread_count : omp_get_max_threads();
+	std::vector<R> partial(parts, R());
+#pragma omp parallel for num_threads(parts)
+	for (int part = 0; part < parts; ++part) {
+		long long b, e;
+		split_range(begin, end, parts, part, b, e);
+		partial[part] = run_range<R>(p.inner, b, e, kernel);
+	}
+	R result = R();
+	for (const R& r : partial) result += r;
+	return result;
+}
+#endif
+
+#ifdef MPI_VERSION
+// Every rank ends up with the combined result.
+template<typename R, typename Inner, typename Kernel>
+R run_range(const mpi_policy<Inner>& p, long long begin, long long end, Kernel& kernel) {
+	int rank, size;
+	MPI_Comm_rank(p.comm, &rank);
+	MPI_Comm_size(p.comm, &size);
+	long long b, e;
+	split_range(begin, end, size, rank, b, e);
+	R local = run_range<R>(p.inner, b, e, kernel);
+	return kernel.combine(local, p.comm);
+}
+#endif
+
+// ---- Numerical integration ----------------------------------------------
+//
+// Every rule is a weighted sum over grid points x_i = a + i*h:
+//   integral ~= h * scale * sum w(i) * f(x_i)
+
+struct rectangle_rule {
+	static long long points(long long n) { return n; }
+	static long long intervals(long long n) { return n; }
+	static double scale() { return 1.0; }
+	static float weight(long long, long long) { return 1.0f; }
+};
+
+struct trapezoid_rule {
+	static long long points(long long n) { return n + 1; }
+	static long long intervals(long long n) { return n; }
+	static double scale() { return 1.0; }
+	static float weight(long long i, long long n) { return (i == 0 || i == n) ? 0.5f : 1.0f; }
+};
+
+struct simpson_rule {
+	static long long points(long long n) { return intervals(n) + 1; }
+	static long long intervals(long long n) { return n % 2 ? n + 1 : n; }
+	static double scale() { return 1.0 / 3.0; }
+	static float weight(long long i, long long n) {
+		return (i == 0 || i == n) ? 1.0f : (i % 2 ? 4.0f : 2.0f);
+	}
+};
+
+static const rectangle_rule rectangle{};
+static const trapezoid_rule trapezoid{};
+static const simpson_rule simpson{};
+
+// Detects an integrand that also accepts four floats at once.
+template<typename F, typename = void>
+struct has_simd_overload : std::false_type {};
+
+template<typename F>
+struct has_simd_overload<F, decltype((void)std::declval<const F&>()(std::declval<__m128>()))> : std::true_type {};
+
+template<typename F>
+__m128 eval4(const F& f, __m128 x, std::true_type) {
+	return f(x);
+}
+
+template<typename F>
+__m128 eval4(const F& f, __m128 x, std::false_type) {
+	alignas(16) float v[4];
+	_mm_store_ps(v, x);
+	return _mm_set_ps(f(v[3]), f(v[2]), f(v[1]), f(v[0]));
+}
+
+// Detects an integrand that also accepts two doubles at once.
+template<typename F, typename = void>
+struct has_simd_overload_pd : std::false_type {};
+
+template<typename F>
+struct has_simd_overload_pd<F, decltype((void)std::declval<const F&>()(std::declval<__m128d>()))> : std::true_type {};
+
+template<typename F>
+__m128d eval2(const F& f, __m128d x, std::true_type) {
+	return f(x);
+}
+
+template<typename F>
+__m128d eval2(const F& f, __m128d x, std::false_type) {
+	alignas(16) double v[2];
+	_mm_store_pd(v, x);
+	return _mm_set_pd(f(v[1]), f(v[0]));
+}
+
+template<typename Rule, typename F, typename T>
+struct IntegrateKernel {
+	const F& f;
+	T a, h;
+	long long n;
+
+	double operator()(seq_policy, long long begin, long long end) const {
+		double sum = 0.0;
+		for (long long i = begin; i < end; ++i) {
+			sum += Rule::weight(i, n) * f(a + T(i) * h);
+		}
+		return sum;
+	}
+
+	double operator()(simd_policy, long long begin, long long end) const {
+		static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value,
+			"simd integration needs float or double bounds");
+		return simd_sum(begin, end, std::is_same<T, float>());
+	}
+
+	// Two doubles per __m128d, two registers per step. Grid points are
+	// computed exactly as in the scalar loop; f gets both lanes at once when
+	// it has an __m128d overload and is called per lane otherwise.
+	double simd_sum(long long begin, long long end, std::false_type) const {
+		const __m128d va = _mm_set1_pd(a);
+		const __m128d vh = _mm_set1_pd(h);
+		const __m128d lane_lo = _mm_set_pd(1.0, 0.0);
+		const __m128d lane_hi = _mm_set_pd(3.0, 2.0);
+		__m128d acc_lo = _mm_setzero_pd(), acc_hi = _mm_setzero_pd();
+		long long i = begin;
+		for (; i + 4 <= end; i += 4) {
+			const __m128d idx = _mm_set1_pd(double(i));
+			__m128d x_lo = _mm_add_pd(va, _mm_mul_pd(_mm_add_pd(idx, lane_lo), vh));
+			__m128d x_hi = _mm_add_pd(va, _mm_mul_pd(_mm_add_pd(idx, lane_hi), vh));
+			__m128d w_lo = _mm_set_pd(Rule::weight(i + 1, n), Rule::weight(i, n));
+			__m128d w_hi = _mm_set_pd(Rule::weight(i + 3, n), Rule::weight(i + 2, n));
+			acc_lo = _mm_add_pd(acc_lo, _mm_mul_pd(w_lo, eval2(f, x_lo, has_simd_overload_pd<F>())));
+			acc_hi = _mm_add_pd(acc_hi, _mm_mul_pd(w_hi, eval2(f, x_hi, has_simd_overload_pd<F>())));
+		}
+		__m128d acc = _mm_add_pd(acc_lo, acc_hi);
+		double sum = _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+		return sum + (*this)(seq, i, end);
+	}
+
+	// f is evaluated four floats at a time. The grid points are computed in
+	// double so that large indices stay exact, and the weighted values are
+	// widened to two __m128d accumulators.
+	double simd_sum(long long begin, long long end, std::true_type) const {
+		const __m128d va = _mm_set1_pd(a);
+		const __m128d vh = _mm_set1_pd(h);
+		const __m128d lane_lo = _mm_set_pd(1.0, 0.0);
+		const __m128d lane_hi = _mm_set_pd(3.0, 2.0);
+		__m128d acc_lo = _mm_setzero_pd(), acc_hi = _mm_setzero_pd();
+		long long i = begin;
+		for (; i + 4 <= end; i += 4) {
+			const __m128d idx = _mm_set1_pd(double(i));
+			__m128 x_lo = _mm_cvtpd_ps(_mm_add_pd(va, _mm_mul_pd(_mm_add_pd(idx, lane_lo), vh)));
+			__m128 x_hi = _mm_cvtpd_ps(_mm_add_pd(va, _mm_mul_pd(_mm_add_pd(idx, lane_hi), vh)));
+			__m128 x = _mm_movelh_ps(x_lo, x_hi);
+			__m128 w = _mm_set_ps(Rule::weight(i + 3, n), Rule::weight(i + 2, n),
+				Rule::weight(i + 1, n), Rule::weight(i, n));
+			__m128 y = _mm_mul_ps(w, eval4(f, x, has_simd_overload<F>()));
+			acc_lo = _mm_add_pd(acc_lo, _mm_cvtps_pd(y));
+			acc_hi = _mm_add_pd(acc_hi, _mm_cvtps_pd(_mm_movehl_ps(y, y)));
+		}
+		__m128d acc = _mm_add_pd(acc_lo, acc_hi);
+		double sum = _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+		return sum + (*this)(seq, i, end);
+	}
+
+#ifdef MPI_VERSION
+	double combine(double local, MPI_Comm comm) const {
+		double global = 0.0;
+		MPI_Allreduce(&local, &global, 1, MPI_DOUBLE, MPI_SUM, comm);
+		return global;
+	}
+#endif
+};
+
+template<typename Policy, typename Rule, typename F, typename T>
+T integrate(const Policy& policy, Rule, const F& f, T a, T b, long long n) {
+	long long intervals = Rule::intervals(n);
+	T h = (b - a) / T(intervals);
+	IntegrateKernel<Rule, F, T> kernel{ f, a, h, intervals };
+	double sum = run_range<double>(policy, 0, Rule::points(n), kernel);
+	return T(sum * double(h) * Rule::scale());
+}
+
+// ---- Matrix multiply ------------------------------------------------------
+//
+// Works on anything that exposes get_rows(), get_cols() and row(i) returning
+// a pointer to a contiguous row: C = A * B, split over rows of C.
+
+inline void axpy_row(seq_policy, double alpha, const double* x, double* y, int n) {
+	for (int j = 0; j < n; ++j) y[j] += alpha * x[j];
+}
+
+inline void axpy_row(seq_policy, float alpha, const float* x, float* y, int n) {
+	for (int j = 0; j < n; ++j) y[j] += alpha * x[j];
+}
+
+inline void axpy_row(simd_policy, double alpha, const double* x, double* y, int n) {
+	__m128d va = _mm_set1_pd(alpha);
+	int j = 0;
+	for (; j + 2 <= n; j += 2) {
+		_mm_storeu_pd(y + j, _mm_add_pd(_mm_loadu_pd(y + j), _mm_mul_pd(va, _mm_loadu_pd(x + j))));
+	}
+	for (; j < n; ++j) y[j] += alpha * x[j];
+}
+
+inline void axpy_row(simd_policy, float alpha, const float* x, float* y, int n) {
+	__m128 va = _mm_set1_ps(alpha);
+	int j = 0;
+	for (; j + 4 <= n; j += 4) {
+		_mm_storeu_ps(y + j, _mm_add_ps(_mm_loadu_ps(y + j), _mm_mul_ps(va, _mm_loadu_ps(x + j))));
+	}
+	for (; j < n; ++j) y[j] += alpha * x[j];
+}
+
+PC_TARGET("avx") inline void axpy_row(avx_policy, double alpha, const double* x, double* y, int n) {
+	__m256d va = _mm256_set1_pd(alpha);
+	int j = 0;
+	for (; j + 4 <= n; j += 4) {
+		_mm256_storeu_pd(y + j, _mm256_add_pd(_mm256_loadu_pd(y + j), _mm256_mul_pd(va, _mm256_loadu_pd(x + j))));
+	}
+	for (; j < n; ++j) y[j] += alpha * x[j];
+}
+
+PC_TARGET("avx") inline void axpy_row(avx_policy, float alpha, const float* x, float* y, int n) {
+	__m256 va = _mm256_set1_ps(alpha);
+	int j = 0;
+	for (; j + 8 <= n; j += 8) {
+		_mm256_storeu_ps(y + j, _mm256_add_ps(_mm256_loadu_ps(y + j), _mm256_mul_ps(va, _mm256_loadu_ps(x + j))));
+	}
+	for (; j < n; ++j) y[j] += alpha * x[j];
+}
+
+// 16-bit storage (A and B in fp16/bf16, C in float): B rows are widened to
+// fp32 a chunk at a time and the products accumulate in fp32.
+template<typename Low>
+void axpy_row_widened(seq_policy, float alpha, const Low* x, float* y, int n) {
+	for (int j = 0; j < n; ++j) y[j] += alpha * float(x[j]);
+}
+
+template<typename Low>
+void axpy_row_widened(simd_policy leaf, float alpha, const Low* x, float* y, int n) {
+	float wide[256];
+	for (int j = 0; j < n; j += 256) {
+		int m = std::min(256, n - j);
+		to_float(x + j, wide, m);
+		axpy_row(leaf, alpha, wide, y + j, m);
+	}
+}
+
+template<typename Leaf>
+void axpy_row(Leaf leaf, float alpha, const half* x, float* y, int n) { axpy_row_widened(leaf, alpha, x, y, n); }
+
+template<typename Leaf>
+void axpy_row(Leaf leaf, float alpha, const bfloat16* x, float* y, int n) { axpy_row_widened(leaf, alpha, x, y, n); }
+
+// Cache blocking for gemm: B is walked in k x j tiles so that a tile stays in
+// cache while every row of the current range uses it. 0 means no blocking.
+struct GemmTiles {
+	int k = 0;
+	int j = 0;
+};
+
+template<typename MatA, typename MatB, typename MatC>
+struct GemmKernel {
+	const MatA& a;
+	const MatB& b;
+	MatC& c;
+	GemmTiles tiles;
+
+	// Returns the number of rows produced so the range runner can add them up.
+	template<typename Leaf>
+	long long operator()(Leaf leaf, long long begin, long long end) const {
+		const int inner = a.get_cols();
+		const int cols = b.get_cols();
+		const int tile_k = tiles.k > 0 ? tiles.k : inner;
+		const int tile_j = tiles.j > 0 ? tiles.j : cols;
+
+		for (long long i = begin; i < end; ++i) {
+			auto* c_row = c.row((int)i);
+			for (int j = 0; j < cols; ++j) c_row[j] = 0;
+		}
+
+		for (int jj = 0; jj < cols; jj += tile_j) {
+			const int width = std::min(tile_j, cols - jj);
+			for (int kk = 0; kk < inner; kk += tile_k) {
+				const int k_end = std::min(kk + tile_k, inner);
+				for (long long i = begin; i < end; ++i) {
+					auto* c_row = c.row((int)i) + jj;
+					const auto* a_row = a.row((int)i);
+					for (int k = kk; k < k_end; ++k) {
+						axpy_row(leaf, a_row[k], b.row(k) + jj, c_row, width);
+					}
+				}
+			}
+		}
+		return end - begin;
+	}
+
+#ifdef MPI_VERSION
+	// Each rank computed a block of rows. The blocks are packed into one
+	// contiguous buffer and exchanged with a single MPI_Allgatherv.
+	long long combine(long long local, MPI_Comm comm) const {
+		typedef typename std::remove_cv<typename std::remove_pointer<decltype(c.row(0))>::type>::type T;
+		int rank, size;
+		MPI_Comm_rank(comm, &rank);
+		MPI_Comm_size(comm, &size);
+		MPI_Datatype type = std::is_same<T, float>::value ? MPI_FLOAT : MPI_DOUBLE;
+		const int rows = c.get_rows(), cols = c.get_cols();
+		std::vector<int> counts(size), displs(size);
+		for (int r = 0; r < size; ++r) {
+			long long b_row, e_row;
+			split_range(0, rows, size, r, b_row, e_row);
+			counts[r] = (int)((e_row - b_row) * cols);
+			displs[r] = (int)(b_row * cols);
+		}
+		std::vector<T> staging((size_t)rows * cols);
+		long long begin, end;
+		split_range(0, rows, size, rank, begin, end);
+		for (long long i = begin; i < end; ++i) {
+			std::copy(c.row((int)i), c.row((int)i) + cols, staging.begin() + (size_t)i * cols);
+		}
+		MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, staging.data(), counts.data(), displs.data(), type, comm);
+		for (int i = 0; i < rows; ++i) {
+			std::copy(staging.begin() + (size_t)i * cols, staging.begin() + (size_t)(i + 1) * cols, c.row(i));
+		}
+		long long total = 0;
+		MPI_Allreduce(&local, &total, 1, MPI_LONG_LONG, MPI_SUM, comm);
+		return total;
+	}
+#endif
+};
+
+template<typename Policy, typename MatA, typename MatB, typename MatC>
+void gemm(const Policy& policy, const MatA& a, const MatB& b, MatC& c, GemmTiles tiles = GemmTiles()) {
+	GemmKernel<MatA, MatB, MatC> kernel{ a, b, c, tiles };
+	run_range<long long>(policy, 0, a.get_rows(), kernel);
+}
+
+// ---- Transpose ------------------------------------------------------------
+//
+// B = A^T for the same row(i) interface, B sized get_cols() x get_rows().
+// The range is over rows of B, so every piece writes whole rows of its own.
+// Inside a piece the block is halved along its longer side until both sides
+// are at most transpose_tile: cache-oblivious, no cache size is assumed. The
+// simd leaf moves 2 x 2 doubles or 4 x 4 floats at a time and transposes
+// them in registers with unpacks.
+
+const int transpose_tile = 32;
+
+// A size x size block held in registers: rows[r][col + c] on load,
+// element (c, r) of it on store after transpose().
+template<typename T>
+struct TransposeBlock {
+	static const int size = 1;
+	T v;
+
+	void load(const T* const* rows, int col) { v = rows[0][col]; }
+	void transpose() {}
+	void store(T* const* rows, int col) const { rows[0][col] = v; }
+};
+
+template<>
+struct TransposeBlock<double> {
+	static const int size = 2;
+	__m128d r[2];
+
+	void load(const double* const* rows, int col) {
+		r[0] = _mm_loadu_pd(rows[0] + col);
+		r[1] = _mm_loadu_pd(rows[1] + col);
+	}
+
+	void transpose() {
+		__m128d lo = _mm_unpacklo_pd(r[0], r[1]);
+		r[1] = _mm_unpackhi_pd(r[0], r[1]);
+		r[0] = lo;
+	}
+
+	void store(double* const* rows, int col) const {
+		_mm_storeu_pd(rows[0] + col, r[0]);
+		_mm_storeu_pd(rows[1] + col, r[1]);
+	}
+};
+
+template<>
+struct TransposeBlock<float> {
+	static const int size = 4;
+	__m128 r[4];
+
+	void load(const float* const* rows, int col) {
+		for (int k = 0; k < 4; ++k) r[k] = _mm_loadu_ps(rows[k] + col);
+	}
+
+	void transpose() { _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]); }
+
+	void store(float* const* rows, int col) const {
+		for (int k = 0; k < 4; ++k) _mm_storeu_ps(rows[k] + col, r[k]);
+	}
+};
+
+template<typename Mat>
+using element_type = typename std::remove_cv<typename std::remove_pointer<decltype(std::declval<Mat&>().row(0))>::type>::type;
+
+// B[j][i] = A[i][j] for i in [i0, i1), j in [j0, j1).
+template<typename MatA, typename MatB>
+void transpose_tile_copy(seq_policy, const MatA& a, MatB& b, int i0, int i1, int j0, int j1) {
+	for (int i = i0; i < i1; ++i) {
+		const auto* a_row = a.row(i);
+		for (int j = j0; j < j1; ++j) b.row(j)[i] = a_row[j];
+	}
+}
+
+template<typename MatA, typename MatB>
+void transpose_tile_copy(simd_policy, const MatA& a, MatB& b, int i0, int i1, int j0, int j1) {
+	typedef element_type<MatB> T;
+	typedef TransposeBlock<T> Block;
+	const int w = Block::size;
+	int i = i0;
+	for (; i + w <= i1; i += w) {
+		const T* src[Block::size];
+		for (int r = 0; r < w; ++r) src[r] = a.row(i + r);
+		int j = j0;
+		for (; j + w <= j1; j += w) {
+			T* dst[Block::size];
+			for (int r = 0; r < w; ++r) dst[r] = b.row(j + r);
+			Block block;
+			block.load(src, j);
+			block.transpose();
+			block.store(dst, i);
+		}
+		for (; j < j1; ++j) {
+			for (int r = 0; r < w; ++r) b.row(j)[i + r] = src[r][j];
+		}
+	}
+	transpose_tile_copy(seq, a, b, i, i1, j0, j1);
+}
+
+// Halves are split at a multiple of 4 so simd blocks never straddle them.
+template<typename Leaf, typename MatA, typename MatB>
+void transpose_recursive(Leaf leaf, const MatA& a, MatB& b, int i0, int i1, int j0, int j1) {
+	if (i1 - i0 <= transpose_tile && j1 - j0 <= transpose_tile) {
+		transpose_tile_copy(leaf, a, b, i0, i1, j0, j1);
+	}
+	else if (i1 - i0 >= j1 - j0) {
+		const int mid = i0 + (((i1 - i0) / 2) & ~3);
+		transpose_recursive(leaf, a, b, i0, mid, j0, j1);
+		transpose_recursive(leaf, a, b, mid, i1, j0, j1);
+	}
+	else {
+		const int mid = j0 + (((j1 - j0) / 2) & ~3);
+		transpose_recursive(leaf, a, b, i0, i1, j0, mid);
+		transpose_recursive(leaf, a, b, i0, i1, mid, j1);
+	}
+}
+
+template<typename MatA, typename MatB>
+struct TransposeKernel {
+	const MatA& a;
+	MatB& b;
+
+	template<typename Leaf>
+	long long operator()(Leaf leaf, long long begin, long long end) const {
+		transpose_recursive(leaf, a, b, 0, a.get_rows(), (int)begin, (int)end);
+		return end - begin;
+	}
+};
+
+template<typename Policy, typename MatA, typename MatB>
+void transpose(const Policy& policy, const MatA& a, MatB& b) {
+	TransposeKernel<MatA, MatB> kernel{ a, b };
+	run_range<long long>(policy, 0, a.get_cols(), kernel);
+}
+
+// Swaps A[i][j] with A[j][i] for i in [i0, i1), j in [j0, j1), j > i. On
+// the diagonal (i0 == j0) that is the upper triangle of the tile.
+template<typename Mat>
+void transpose_tile_swap(seq_policy, Mat& a, int i0, int i1, int j0, int j1) {
+	for (int i = i0; i < i1; ++i) {
+		auto* a_row = a.row(i);
+		for (int j = std::max(j0, i + 1); j < j1; ++j) std::swap(a_row[j], a.row(j)[i]);
+	}
+}
+
+template<typename Mat>
+void transpose_tile_swap(simd_policy, Mat& a, int i0, int i1, int j0, int j1) {
+	typedef element_type<Mat> T;
+	typedef TransposeBlock<T> Block;
+	const int w = Block::size;
+	int i = i0;
+	for (; i + w <= i1; i += w) {
+		T* upper[Block::size];
+		for (int r = 0; r < w; ++r) upper[r] = a.row(i + r);
+		int j = std::max(j0, i);
+		for (; j + w <= j1; j += w) {
+			T* lower[Block::size];
+			for (int r = 0; r < w; ++r) lower[r] = a.row(j + r);
+			Block x, y;
+			x.load(upper, j);
+			y.load(lower, i);
+			x.transpose();
+			y.transpose();
+			x.store(lower, i);
+			y.store(upper, j);
+		}
+		for (int r = 0; r < w; ++r) {
+			for (int jj = std::max(j, i + r + 1); jj < j1; ++jj) std::swap(upper[r][jj], a.row(jj)[i + r]);
+		}
+	}
+	transpose_tile_swap(seq, a, i, i1, j0, j1);
+}
+
+// In place, square matrices only. Tile row t owns the tiles (t, u), u >= t,
+// and swaps each with its mirror (u, t). Item p of the range is the pair of
+// tile rows p and tiles - 1 - p, so all items carry about the same work.
+template<typename Mat>
+struct TransposeInPlaceKernel {
+	Mat& a;
+
+	template<typename Leaf>
+	void tile_row(Leaf leaf, int t) const {
+		const int n = a.get_rows();
+		const int i0 = t * transpose_tile, i1 = std::min(i0 + transpose_tile, n);
+		for (int j0 = i0; j0 < n; j0 += transpose_tile) {
+			transpose_tile_swap(leaf, a, i0, i1, j0, std::min(j0 + transpose_tile, n));
+		}
+	}
+
+	template<typename Leaf>
+	long long operator()(Leaf leaf, long long begin, long long end) const {
+		const int tiles = (a.get_rows() + transpose_tile - 1) / transpose_tile;
+		for (long long p = begin; p < end; ++p) {
+			tile_row(leaf, (int)p);
+			if (tiles - 1 - p != p) tile_row(leaf, tiles - 1 - (int)p);
+		}
+		return end - begin;
+	}
+};
+
+template<typename Policy, typename Mat>
+void transpose_in_place(const Policy& policy, Mat& a) {
+	if (a.get_rows() != a.get_cols()) throw std::invalid_argument("transpose_in_place needs a square matrix");
+	TransposeInPlaceKernel<Mat> kernel{ a };
+	const long long tiles = (a.get_rows() + transpose_tile - 1) / transpose_tile;
+	run_range<long long>(policy, 0, (tiles + 1) / 2, kernel);
+}
+
+// ---- Matrix-vector products -----------------------------------------------
+//
+// y = A x (gemv) and y = x^T A (gevm). Each element of A is used once, so
+// both are bound by memory bandwidth. The matrix is read with prefetchnta
+// a few cache lines ahead: its lines are streamed in without displacing x
+// and y from the outer caches. gemv splits rows of A; gevm splits columns,
+// each piece owning its slice of y and sweeping it down all rows
+// gevm_strip columns at a time so that the slice of y stays in L1.
+
+const int gevm_strip = 2048;
+const int stream_prefetch_bytes = 512;
+
+inline double dot(seq_policy, const double* row, const double* x, int n) {
+	double sum = 0;
+	for (int j = 0; j < n; ++j) sum += row[j] * x[j];
+	return sum;
+}
+
+inline float dot(seq_policy, const float* row, const float* x, int n) {
+	float sum = 0;
+	for (int j = 0; j < n; ++j) sum += row[j] * x[j];
+	return sum;
+}
+
+// Four accumulators, one cache line of the row per iteration.
+inline double dot(simd_policy, const double* row, const double* x, int n) {
+	__m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd(), s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+	int j = 0;
+	for (; j + 8 <= n; j += 8) {
+		_mm_prefetch(reinterpret_cast<const char*>(row + j) + stream_prefetch_bytes, _MM_HINT_NTA);
+		s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(row + j), _mm_loadu_pd(x + j)));
+		s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(row + j + 2), _mm_loadu_pd(x + j + 2)));
+		s2 = _mm_add_pd(s2, _mm_mul_pd(_mm_loadu_pd(row + j + 4), _mm_loadu_pd(x + j + 4)));
+		s3 = _mm_add_pd(s3, _mm_mul_pd(_mm_loadu_pd(row + j + 6), _mm_loadu_pd(x + j + 6)));
+	}
+	for (; j + 2 <= n; j += 2) s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(row + j), _mm_loadu_pd(x + j)));
+	__m128d s = _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3));
+	double sum = _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+	for (; j < n; ++j) sum += row[j] * x[j];
+	return sum;
+}
+
+inline float dot(simd_policy, const float* row, const float* x, int n) {
+	__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+	int j = 0;
+	for (; j + 16 <= n; j += 16) {
+		_mm_prefetch(reinterpret_cast<const char*>(row + j) + stream_prefetch_bytes, _MM_HINT_NTA);
+		s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(row + j), _mm_loadu_ps(x + j)));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(row + j + 4), _mm_loadu_ps(x + j + 4)));
+		s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(row + j + 8), _mm_loadu_ps(x + j + 8)));
+		s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(row + j + 12), _mm_loadu_ps(x + j + 12)));
+	}
+	for (; j + 4 <= n; j += 4) s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(row + j), _mm_loadu_ps(x + j)));
+	__m128 s = _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	float sum = _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+	for (; j < n; ++j) sum += row[j] * x[j];
+	return sum;
+}
+
+template<typename Mat, typename T>
+struct GemvKernel {
+	const Mat& a;
+	const T* x;
+	T* y;
+
+	template<typename Leaf>
+	long long operator()(Leaf leaf, long long begin, long long end) const {
+		const int cols = a.get_cols();
+		for (long long i = begin; i < end; ++i) y[i] = dot(leaf, a.row((int)i), x, cols);
+		return end - begin;
+	}
+};
+
+template<typename Mat, typename T>
+struct GevmKernel {
+	const Mat& a;
+	const T* x;
+	T* y;
+
+	template<typename Leaf>
+	long long operator()(Leaf leaf, long long begin, long long end) const {
+		const int rows = a.get_rows();
+		for (long long jj = begin; jj < end; jj += gevm_strip) {
+			const int j0 = (int)jj, width = (int)std::min<long long>(gevm_strip, end - jj);
+			for (int j = 0; j < width; ++j) y[j0 + j] = 0;
+			for (int i = 0; i < rows; ++i) {
+				const T* a_row = a.row(i) + j0;
+				_mm_prefetch(reinterpret_cast<const char*>(a_row) + stream_prefetch_bytes, _MM_HINT_NTA);
+				axpy_row(leaf, x[i], a_row, y + j0, width);
+			}
+		}
+		return end - begin;
+	}
+};
+
+// y has get_rows() elements, x get_cols().
+template<typename Policy, typename Mat, typename T>
+void gemv(const Policy& policy, const Mat& a, const T* x, T* y) {
+	GemvKernel<Mat, T> kernel{ a, x, y };
+	run_range<long long>(policy, 0, a.get_rows(), kernel);
+}
+
+// y has get_cols() elements, x get_rows().
+template<typename Policy, typename Mat, typename T>
+void gevm(const Policy& policy, const Mat& a, const T* x, T* y) {
+	GevmKernel<Mat, T> kernel{ a, x, y };
+	run_range<long long>(policy, 0, a.get_cols(), kernel);
+}
+
+// ---- Run-time selection ---------------------------------------------------
+//
+// Grammar: [mpi+][threads[:N]+|openmp[:N]+](seq|simd), e.g. "threads:8+simd".
+
+struct RuntimePolicy {
+	enum Node { none, thread_pool, omp };
+
+	bool use_mpi = false;
+	Node node = none;
+	int thread_count = 0;
+	bool use_simd = false;
+	std::shared_ptr<ThreadPool> pool;
+};
+
+inline RuntimePolicy parse_policy(const std::string& text) {
+	RuntimePolicy p;
+	size_t pos = 0;
+	while (pos <= text.size()) {
+		size_t plus = text.find('+', pos);
+		std::string part = text.substr(pos, plus == std::string::npos ? std::string::npos : plus - pos);
+		std::string name = part.substr(0, part.find(':'));
+		int count = part.find(':') == std::string::npos ? 0 : std::atoi(part.c_str() + part.find(':') + 1);
+
+		if (name == "seq") p.use_simd = false;
+		else if (name == "simd") p.use_simd = true;
+		else if (name == "threads") { p.node = RuntimePolicy::thread_pool; p.thread_count = count; }
+		else if (name == "openmp") { p.node = RuntimePolicy::omp; p.thread_count = count; }
+		else if (name == "mpi") p.use_mpi = true;
+		else throw std::invalid_argument("unknown execution policy '" + part + "'");
+
+		if (plus == std::string::npos) break;
+		pos = plus + 1;
+	}
+
+#ifndef _OPENMP
+	if (p.node == RuntimePolicy::omp) throw std::invalid_argument("built without OpenMP");
+#endif
+#ifndef MPI_VERSION
+	if (p.use_mpi) throw std::invalid_argument("built without MPI");
+#endif
+	if (p.node == RuntimePolicy::thread_pool) p.pool = std::make_shared<ThreadPool>(p.thread_count);
+	return p;
+}
+
+template<typename F>
+auto with_leaf(const RuntimePolicy& p, F&& f) -> decltype(f(seq)) {
+	return p.use_simd ? f(simd) : f(seq);
+}
+
+template<typename Leaf, typename F>
+auto with_node(const RuntimePolicy& p, Leaf leaf, F&& f) -> decltype(f(leaf)) {
+	switch (p.node) {
+	case RuntimePolicy::thread_pool:
+		return f(threads(*p.pool, leaf));
+#ifdef _OPENMP
+	case RuntimePolicy::omp:
+		return f(openmp(leaf, p.thread_count));
+#endif
+	default:
+		return f(leaf);
+	}
+}
+
+// Calls f with the compile-time policy described by p.
+template<typename F>
+auto with_policy(const RuntimePolicy& p, F&& f) -> decltype(f(seq)) {
+	return with_leaf(p, [&](auto leaf) {
+		return with_node(p, leaf, [&](auto node) {
+#ifdef MPI_VERSION
+			if (p.use_mpi) return f(mpi(MPI_COMM_WORLD, node));
+#endif
+			return f(node);
+			});
+		});
+}
+
+template<typename Rule, typename F, typename T>
+T integrate(const RuntimePolicy& policy, Rule rule, const F& f, T a, T b, long long n) {
+	return with_policy(policy, [&](auto p) { return integrate(p, rule, f, a, b, n); });
+}
+
+template<typename MatA, typename MatB, typename MatC>
+void gemm(const RuntimePolicy& policy, const MatA& a, const MatB& b, MatC& c, GemmTiles tiles = GemmTiles()) {
+	with_policy(policy, [&](auto p) { gemm(p, a, b, c, tiles); });
+}
+
+}
@@ -0,0 +1,545 @@
+#pragma once
+
+// Low-overhead contention and queue metrics for synchronization code.
+//
+//   const metrics::LockMetrics lock_metrics("queue.lock");
+//   const metrics::Metric depth = metrics::histogram("queue.depth");
+//   {
+//       metrics::TimedLock<std::mutex> lock(mtx, lock_metrics);
+//       lock.wait(cv, [&] { return !q.empty(); }, lock_metrics.wait);
+//       ...
+//       metrics::gauge(depth, q.size());
+//   }
+//   metrics::snapshot().print(std::cout);
+//   metrics::write_trace("trace.json");
+//
+// Metrics are registered once by name and then addressed by index. Every
+// thread writes only its own shard: relaxed stores, no locks and no cache
+// lines shared with other threads. Shards outlive their threads, so
+// short-lived workers still count: an exiting thread returns its shard, counts
+// and trace events included, and the next new thread continues in it. Memory
+// is bounded by the peak number of live threads. snapshot() merges the shards while they
+// are being written; it may miss the latest updates but never tears a value.
+//
+// Kinds:
+//   counter    running total; snapshots report the total and the rate
+//   histogram  log2-bucketed values (nanoseconds, queue depths) with count,
+//              mean, max and percentiles rounded up to the bucket bound
+// TimedLock records how long acquiring the mutex took (wait, zero when it was
+// free), how long it was held, not counting condition-variable waits (hold),
+// and how many acquisitions found it taken (contended). Sampler prints or
+// hands over a snapshot of the last interval periodically.
+//
+// With enable_trace() every thread also keeps a bounded buffer of timeline
+// events: lock holds and Span scopes as slices, gauge() values as counter
+// tracks. write_trace() dumps them in the Chrome trace format for
+// chrome://tracing or Perfetto.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace metrics {
+
+using Clock = std::chrono::steady_clock;
+using Metric = int;
+
+enum class Kind {
+	counter,
+	histogram
+};
+
+const int max_metrics = 128;
+// Bucket b holds values in [2^(b-1), 2^b); bucket 0 holds zero.
+const int bucket_count = 64;
+
+inline int bucket_of(uint64_t v) {
+	if (v == 0) return 0;
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long bit;
+	_BitScanReverse64(&bit, v);
+	return std::min((int)bit + 1, bucket_count - 1);
+#elif defined(_MSC_VER)
+	// 32-bit targets only have the 32-bit scan: high half first.
+	unsigned long bit;
+	if (_BitScanReverse(&bit, (unsigned long)(v >> 32))) return std::min((int)bit + 33, bucket_count - 1);
+	_BitScanReverse(&bit, (unsigned long)v);
+	return (int)bit + 1;
+#else
+	return std::min(64 - __builtin_clzll(v), bucket_count - 1);
+#endif
+}
+
+inline uint64_t bucket_bound(int b) { return b == 0 ? 0 : b >= 63 ? UINT64_MAX : (uint64_t(1) << b) - 1; }
+
+inline Clock::time_point epoch() {
+	static const Clock::time_point start = Clock::now();
+	return start;
+}
+
+inline uint64_t nanoseconds(Clock::time_point from, Clock::time_point to) {
+	return to > from ? (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count() : 0;
+}
+
+struct MetricInfo {
+	std::string name;
+	Kind kind;
+};
+
+class Names {
+private:
+	std::mutex mtx;
+	std::vector<MetricInfo> infos;
+
+public:
+	Metric add(const std::string& name, Kind kind) {
+		std::lock_guard<std::mutex> lock(mtx);
+		for (size_t m = 0; m < infos.size(); ++m) {
+			if (infos[m].name != name) continue;
+			if (infos[m].kind != kind) throw std::logic_error("metric " + name + " registered with another kind");
+			return (Metric)m;
+		}
+		if ((int)infos.size() == max_metrics) throw std::length_error("too many metrics");
+		infos.push_back(MetricInfo{ name, kind });
+		return (Metric)infos.size() - 1;
+	}
+
+	std::vector<MetricInfo> list() {
+		std::lock_guard<std::mutex> lock(mtx);
+		return infos;
+	}
+};
+
+inline Names& names() {
+	static Names n;
+	return n;
+}
+
+// Registering the same name again returns the same metric.
+inline Metric counter(const std::string& name) { return names().add(name, Kind::counter); }
+inline Metric histogram(const std::string& name) { return names().add(name, Kind::histogram); }
+
+struct TraceEvent {
+	Metric metric;
+	char phase;        // 'X' slice, 'C' counter value
+	uint64_t start;    // ns since epoch()
+	uint64_t value;    // duration for slices
+};
+
+// One thread's metrics. Only the owning thread writes, so updates are plain
+// load + store; the atomics only make concurrent snapshots well defined.
+struct alignas(64) Shard {
+	struct Cell {
+		std::atomic<uint64_t> count{ 0 };
+		std::atomic<uint64_t> sum{ 0 };
+		std::atomic<uint64_t> max{ 0 };
+		std::atomic<uint64_t> buckets[bucket_count] = {};
+	};
+
+	int thread = 0;
+	Cell cells[max_metrics];
+	std::unique_ptr<TraceEvent[]> events;
+	size_t event_capacity = 0;
+	std::atomic<size_t> event_count{ 0 };
+};
+
+inline void bump(std::atomic<uint64_t>& a, uint64_t n) {
+	a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+class Shards {
+private:
+	std::mutex mtx;
+	std::vector<std::unique_ptr<Shard>> all;
+	std::vector<Shard*> free;
+
+public:
+	Shard* acquire() {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!free.empty()) {
+			Shard* s = free.back();
+			free.pop_back();
+			return s;
+		}
+		std::unique_ptr<Shard> s(new Shard());
+		s->thread = (int)all.size();
+		all.push_back(std::move(s));
+		return all.back().get();
+	}
+
+	void release(Shard* s) {
+		std::lock_guard<std::mutex> lock(mtx);
+		free.push_back(s);
+	}
+
+	template<typename F>
+	void for_each(F f) {
+		std::lock_guard<std::mutex> lock(mtx);
+		for (auto& s : all) f(*s);
+	}
+};
+
+inline Shards& shards() {
+	static Shards s;
+	return s;
+}
+
+// Holds the calling thread's shard and hands it back when the thread exits.
+class ShardLease {
+private:
+	Shard* s;
+
+public:
+	ShardLease() : s(shards().acquire()) {}
+	~ShardLease() { shards().release(s); }
+	ShardLease(const ShardLease&) = delete;
+	ShardLease& operator=(const ShardLease&) = delete;
+
+	Shard& get() { return *s; }
+};
+
+inline Shard& shard() {
+	thread_local ShardLease lease;
+	return lease.get();
+}
+
+inline std::atomic<size_t>& trace_capacity() {
+	static std::atomic<size_t> capacity{ 0 };
+	return capacity;
+}
+
+// Keeps up to events_per_thread timeline events on every thread; later
+// events are dropped. Takes effect for threads that have not traced yet.
+inline void enable_trace(size_t events_per_thread = 100000) {
+	epoch();
+	trace_capacity() = events_per_thread;
+}
+
+inline bool tracing() { return trace_capacity().load(std::memory_order_relaxed) > 0; }
+
+inline void trace(Metric m, char phase, Clock::time_point start, uint64_t value) {
+	if (!tracing()) return;
+	Shard& s = shard();
+	if (!s.events) {
+		s.event_capacity = trace_capacity();
+		s.events.reset(new TraceEvent[s.event_capacity]);
+	}
+	size_t n = s.event_count.load(std::memory_order_relaxed);
+	if (n == s.event_capacity) return;
+	s.events[n] = TraceEvent{ m, phase, nanoseconds(epoch(), start), value };
+	s.event_count.store(n + 1, std::memory_order_release);
+}
+
+inline void add(Metric m, uint64_t n = 1) {
+	bump(shard().cells[m].count, n);
+}
+
+inline void record(Metric m, uint64_t v) {
+	Shard::Cell& c = shard().cells[m];
+	bump(c.count, 1);
+	bump(c.sum, v);
+	if (v > c.max.load(std::memory_order_relaxed)) c.max.store(v, std::memory_order_relaxed);
+	bump(c.buckets[bucket_of(v)], 1);
+}
+
+// record() plus a counter track in the trace, for levels such as queue depth.
+inline void gauge(Metric m, uint64_t v) {
+	record(m, v);
+	trace(m, 'C', Clock::now(), v);
+}
+
+// Records the lifetime of the scope as a histogram value and a trace slice.
+class Span {
+private:
+	Metric metric;
+	Clock::time_point start;
+
+public:
+	explicit Span(Metric duration) : metric(duration), start(Clock::now()) {}
+
+	~Span() {
+		uint64_t ns = nanoseconds(start, Clock::now());
+		record(metric, ns);
+		trace(metric, 'X', start, ns);
+	}
+
+	Span(const Span&) = delete;
+	Span& operator=(const Span&) = delete;
+};
+
+struct LockMetrics {
+	Metric wait;
+	Metric hold;
+	Metric contended;
+
+	explicit LockMetrics(const std::string& name)
+		: wait(histogram(name + ".wait_ns")), hold(histogram(name + ".hold_ns")), contended(counter(name + ".contended")) {}
+};
+
+// unique_lock with wait, hold and contention accounting.
+template<typename Mutex>
+class TimedLock {
+private:
+	std::unique_lock<Mutex> guard;
+	const LockMetrics& m;
+	Clock::time_point acquired;
+	uint64_t held = 0;
+
+	void acquire() {
+		if (guard.try_lock()) {
+			acquired = Clock::now();
+			record(m.wait, 0);
+			return;
+		}
+		Clock::time_point start = Clock::now();
+		guard.lock();
+		acquired = Clock::now();
+		add(m.contended);
+		record(m.wait, nanoseconds(start, acquired));
+	}
+
+	void close_hold(Clock::time_point now) {
+		uint64_t ns = nanoseconds(acquired, now);
+		held += ns;
+		trace(m.hold, 'X', acquired, ns);
+	}
+
+public:
+	TimedLock(Mutex& mtx, const LockMetrics& metrics) : guard(mtx, std::defer_lock), m(metrics) { acquire(); }
+
+	~TimedLock() {
+		if (guard.owns_lock()) unlock();
+	}
+
+	void lock() {
+		held = 0;
+		acquire();
+	}
+
+	void unlock() {
+		close_hold(Clock::now());
+		guard.unlock();
+		record(m.hold, held);
+	}
+
+	// cv.wait(lock, pred) with the time spent waiting recorded to waited.
+	// Time inside the wait does not count as holding the lock.
+	template<typename CV, typename Pred>
+	void wait(CV& cv, Pred pred, Metric waited) {
+		if (pred()) {
+			record(waited, 0);
+			return;
+		}
+		Clock::time_point start = Clock::now();
+		close_hold(start);
+		cv.wait(guard, pred);
+		acquired = Clock::now();
+		record(waited, nanoseconds(start, acquired));
+	}
+
+	std::unique_lock<Mutex>& native() { return guard; }
+
+	TimedLock(const TimedLock&) = delete;
+	TimedLock& operator=(const TimedLock&) = delete;
+};
+
+struct Stat {
+	std::string name;
+	Kind kind = Kind::counter;
+	uint64_t count = 0;
+	uint64_t sum = 0;
+	uint64_t max = 0;
+	uint64_t buckets[bucket_count] = {};
+
+	double mean() const { return count > 0 ? double(sum) / count : 0.0; }
+
+	// Upper bound of the bucket holding the p-th percentile.
+	uint64_t percentile(double p) const {
+		if (count == 0) return 0;
+		uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(p / 100.0 * count)), seen = 0;
+		for (int b = 0; b < bucket_count; ++b) {
+			seen += buckets[b];
+			if (seen >= rank) return std::min(bucket_bound(b), max);
+		}
+		return max;
+	}
+};
+
+struct Snapshot {
+	Clock::time_point start = epoch();
+	Clock::time_point time = epoch();
+	std::vector<Stat> stats;
+
+	double seconds() const { return std::chrono::duration<double>(time - start).count(); }
+
+	// What happened between earlier and this snapshot. max stays the
+	// all-time maximum.
+	Snapshot since(const Snapshot& earlier) const {
+		Snapshot delta = *this;
+		delta.start = earlier.time;
+		for (size_t m = 0; m < delta.stats.size() && m < earlier.stats.size(); ++m) {
+			Stat& d = delta.stats[m];
+			const Stat& e = earlier.stats[m];
+			d.count -= e.count;
+			d.sum -= e.sum;
+			for (int b = 0; b < bucket_count; ++b) d.buckets[b] -= e.buckets[b];
+		}
+		return delta;
+	}
+
+	// Metrics with activity whose name starts with prefix.
+	// Formatted into a string first, so a Sampler printing to the same
+	// stream from its own thread does not race on the stream's flags.
+	void print(std::ostream& out, const std::string& prefix = "") const {
+		const double s = seconds();
+		std::ostringstream text;
+		text << std::fixed << std::setprecision(1);
+		for (const Stat& st : stats) {
+			if (st.count == 0 || st.name.compare(0, prefix.size(), prefix) != 0) continue;
+			text << "  " << std::left << std::setw(32) << st.name << std::right;
+			if (st.kind == Kind::counter) {
+				text << " total " << st.count;
+				if (s > 0.0) text << ", " << st.count / s << "/s";
+			}
+			else {
+				text << " n " << st.count << ", mean " << st.mean()
+					<< ", p50 " << st.percentile(50) << ", p99 " << st.percentile(99) << ", max " << st.max;
+			}
+			text << "\n";
+		}
+		out << text.str();
+	}
+
+	void write_json(std::ostream& out) const {
+		out << "{\"seconds\": " << seconds() << ", \"metrics\": [";
+		bool first = true;
+		for (const Stat& st : stats) {
+			out << (first ? "" : ",") << "\n  {\"name\": \"" << st.name << "\", \"kind\": \""
+				<< (st.kind == Kind::counter ? "counter" : "histogram") << "\", \"count\": " << st.count;
+			if (st.kind == Kind::histogram) {
+				out << ", \"sum\": " << st.sum << ", \"max\": " << st.max
+					<< ", \"p50\": " << st.percentile(50) << ", \"p90\": " << st.percentile(90) << ", \"p99\": " << st.percentile(99);
+			}
+			out << "}";
+			first = false;
+		}
+		out << "\n]}\n";
+	}
+};
+
+inline Snapshot snapshot() {
+	Snapshot snap;
+	snap.time = Clock::now();
+	std::vector<MetricInfo> infos = names().list();
+	snap.stats.resize(infos.size());
+	for (size_t m = 0; m < infos.size(); ++m) {
+		snap.stats[m].name = infos[m].name;
+		snap.stats[m].kind = infos[m].kind;
+	}
+	shards().for_each([&](Shard& s) {
+		for (size_t m = 0; m < infos.size(); ++m) {
+			const Shard::Cell& c = s.cells[m];
+			Stat& st = snap.stats[m];
+			st.count += c.count.load(std::memory_order_relaxed);
+			st.sum += c.sum.load(std::memory_order_relaxed);
+			st.max = std::max(st.max, c.max.load(std::memory_order_relaxed));
+			for (int b = 0; b < bucket_count; ++b) st.buckets[b] += c.buckets[b].load(std::memory_order_relaxed);
+		}
+		});
+	return snap;
+}
+
+// Calls report with the metrics of each interval until destroyed.
+class Sampler {
+private:
+	std::function<void(const Snapshot&)> report;
+	std::chrono::milliseconds interval;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stop = false;
+	std::thread worker;
+
+	void loop() {
+		Snapshot last = snapshot();
+		std::unique_lock<std::mutex> lock(mtx);
+		while (!cv.wait_for(lock, interval, [this] { return stop; })) {
+			lock.unlock();
+			Snapshot now = snapshot();
+			report(now.since(last));
+			last = now;
+			lock.lock();
+		}
+	}
+
+public:
+	Sampler(std::chrono::milliseconds every, std::function<void(const Snapshot&)> callback)
+		: report(std::move(callback)), interval(every), worker([this] { loop(); }) {}
+
+	Sampler(std::chrono::milliseconds every, std::ostream& out, const std::string& prefix = "")
+		: Sampler(every, [&out, prefix](const Snapshot& s) {
+			std::ostringstream text;
+			text << "--- metrics, last " << std::fixed << std::setprecision(2) << s.seconds() << " s ---\n";
+			s.print(text, prefix);
+			out << text.str();
+			}) {}
+
+	~Sampler() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+		cv.notify_all();
+		worker.join();
+	}
+
+	Sampler(const Sampler&) = delete;
+	Sampler& operator=(const Sampler&) = delete;
+};
+
+// Chrome trace event format; timestamps in microseconds since epoch().
+inline void write_trace(std::ostream& out) {
+	std::vector<MetricInfo> infos = names().list();
+	out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+	bool first = true;
+	shards().for_each([&](Shard& s) {
+		size_t n = s.event_count.load(std::memory_order_acquire);
+		for (size_t e = 0; e < n; ++e) {
+			const TraceEvent& ev = s.events[e];
+			out << (first ? "" : ",") << "\n{\"name\": \"" << infos[ev.metric].name << "\", \"ph\": \"" << ev.phase
+				<< "\", \"pid\": 1, \"tid\": " << s.thread << ", \"ts\": " << std::fixed << std::setprecision(3) << ev.start / 1e3;
+			if (ev.phase == 'X') out << ", \"dur\": " << ev.value / 1e3;
+			else out << ", \"args\": {\"value\": " << ev.value << "}";
+			out << "}";
+			first = false;
+		}
+		});
+	out << "\n]}\n";
+	out.unsetf(std::ios::floatfield);
+}
+
+inline bool write_trace(const std::string& path) {
+	std::ofstream out(path);
+	if (!out) return false;
+	write_trace(out);
+	return (bool)out;
+}
+
+}
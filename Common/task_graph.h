@@ -0,0 +1,167 @@
+#pragma once
+
+// Dependency-tracking task graph executed on the ThreadPool.
+//
+// Tasks are added in program order together with the data they read and
+// write (integer keys, e.g. one per matrix tile). The graph derives the
+// dependencies the same way StarPU's sequential task flow does:
+//   read after write   waits for the last writer
+//   write after read   waits for every reader since that write
+//   write after write  waits for the last writer
+// run() then starts every task as soon as its inputs are ready, instead of
+// in bulk-synchronous steps. barrier() makes all later tasks wait for all
+// earlier ones, which turns the same program into a fork-join schedule for
+// comparison.
+//
+// A finished task runs one newly released successor on its own thread and
+// posts the others to the pool. The first exception thrown by a task is
+// rethrown from run() once the remaining tasks have finished. run() blocks,
+// so call it from a thread outside the pool.
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace pc {
+
+class TaskGraph {
+public:
+	using Key = long long;
+
+private:
+	struct Node {
+		std::function<void()> fn;
+		std::vector<int> successors;
+		int dependencies = 0;
+	};
+
+	struct Access {
+		int last_writer = -1;
+		std::vector<int> readers;
+	};
+
+	struct RunState {
+		std::unique_ptr<std::atomic<int>[]> pending;
+		std::atomic<int> remaining{ 0 };
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::exception_ptr error;
+	};
+
+	std::vector<Node> nodes;
+	std::map<Key, Access> accesses;
+	std::vector<int> since_barrier;
+	int last_barrier = -1;
+
+	void depend(int from, int to) {
+		if (from < 0 || from == to) return;
+		std::vector<int>& succ = nodes[from].successors;
+		if (!succ.empty() && succ.back() == to) return;
+		succ.push_back(to);
+		++nodes[to].dependencies;
+	}
+
+	void execute(ThreadPool& pool, RunState& state, int id) {
+		for (;;) {
+			try {
+				nodes[id].fn();
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(state.mtx);
+				if (!state.error) state.error = std::current_exception();
+			}
+
+			int next = -1;
+			for (int s : nodes[id].successors) {
+				if (--state.pending[s] != 0) continue;
+				if (next < 0) next = s;
+				else pool.post([this, &pool, &state, s] { execute(pool, state, s); });
+			}
+
+			{
+				// Under the lock, so run() cannot return while we still touch state.
+				std::lock_guard<std::mutex> lock(state.mtx);
+				if (--state.remaining == 0) state.cv.notify_all();
+			}
+			if (next < 0) return;
+			id = next;
+		}
+	}
+
+public:
+	int add(std::function<void()> fn, const std::vector<Key>& reads, const std::vector<Key>& writes) {
+		int id = (int)nodes.size();
+		nodes.push_back(Node{ std::move(fn), {}, 0 });
+		depend(last_barrier, id);
+
+		for (Key key : reads) {
+			Access& a = accesses[key];
+			depend(a.last_writer, id);
+			a.readers.push_back(id);
+		}
+		for (Key key : writes) {
+			Access& a = accesses[key];
+			depend(a.last_writer, id);
+			for (int r : a.readers) depend(r, id);
+			a.last_writer = id;
+			a.readers.clear();
+		}
+
+		since_barrier.push_back(id);
+		return id;
+	}
+
+	void barrier() {
+		int id = (int)nodes.size();
+		nodes.push_back(Node{ [] {}, {}, 0 });
+		// Two barriers in a row have no tasks between them.
+		depend(last_barrier, id);
+		for (int t : since_barrier) depend(t, id);
+		since_barrier.clear();
+		last_barrier = id;
+	}
+
+	size_t size() const { return nodes.size(); }
+
+	// Runs every task and clears the graph.
+	void run(ThreadPool& pool) {
+		if (!nodes.empty()) {
+			RunState state;
+			state.pending.reset(new std::atomic<int>[nodes.size()]);
+			state.remaining = (int)nodes.size();
+			std::vector<int> ready;
+			for (size_t i = 0; i < nodes.size(); ++i) {
+				state.pending[i] = nodes[i].dependencies;
+				if (nodes[i].dependencies == 0) ready.push_back((int)i);
+			}
+
+			for (int id : ready) pool.post([this, &pool, &state, id] { execute(pool, state, id); });
+
+			std::unique_lock<std::mutex> lock(state.mtx);
+			state.cv.wait(lock, [&] { return state.remaining.load() == 0; });
+			if (state.error) {
+				std::exception_ptr error = state.error;
+				lock.unlock();
+				clear();
+				std::rethrow_exception(error);
+			}
+		}
+		clear();
+	}
+
+	void clear() {
+		nodes.clear();
+		accesses.clear();
+		since_barrier.clear();
+		last_barrier = -1;
+	}
+};
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+// Fixed-size worker pool shared by the threads() execution policy.
+//
+// parallel_for() lets the calling thread take work too, so it never waits on
+// a pool whose workers are all busy; nested calls from inside a task are safe.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace pc {
+
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping = false;
+
+	void worker_loop() {
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty()) return;
+				task = std::move(tasks.front());
+				tasks.pop();
+			}
+			task();
+		}
+	}
+
+public:
+	explicit ThreadPool(int thread_count = 0) {
+		if (thread_count <= 0) thread_count = std::max(1, (int)std::thread::hardware_concurrency());
+		for (int i = 0; i < thread_count; ++i) {
+			workers.emplace_back([this] { worker_loop(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopping = true;
+		}
+		cv.notify_all();
+		for (auto& t : workers) t.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int size() const { return (int)workers.size(); }
+
+	void post(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			tasks.push(std::move(task));
+		}
+		cv.notify_one();
+	}
+
+	template<typename F>
+	auto submit(F f) -> std::future<decltype(f())> {
+		auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+		auto result = task->get_future();
+		post([task] { (*task)(); });
+		return result;
+	}
+
+	// Runs body(i) for i in [0, count) and returns when all of them are done.
+	template<typename F>
+	void parallel_for(int count, F&& body) {
+		if (count <= 0) return;
+
+		struct State {
+			std::atomic<int> next{ 0 };
+			std::atomic<int> done{ 0 };
+			std::mutex mtx;
+			std::condition_variable cv;
+		};
+		auto state = std::make_shared<State>();
+
+		auto run = [state, count, &body] {
+			int finished = 0;
+			for (int i = state->next++; i < count; i = state->next++) {
+				body(i);
+				++finished;
+			}
+			if (finished > 0 && (state->done += finished) == count) {
+				std::lock_guard<std::mutex> lock(state->mtx);
+				state->cv.notify_all();
+			}
+		};
+
+		int helpers = std::min(count - 1, size());
+		for (int i = 0; i < helpers; ++i) post(run);
+		run();
+
+		std::unique_lock<std::mutex> lock(state->mtx);
+		state->cv.wait(lock, [&] { return state->done.load() == count; });
+	}
+};
+
+}
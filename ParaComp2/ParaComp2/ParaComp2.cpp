@@ -1,32 +1,69 @@
 ﻿#include <iostream>
 #include <vector>
-#include <random>
 #include <chrono>
+#include <cmath>
 #include <thread>
 #include <future>
+#include <numeric>
+#include <span>
+#include <memory_resource>
+#define NOMINMAX
 #include <windows.h>
+#include "../../Common/allocators.h"
+#include "../../Common/autotune.h"
+#include "../../Common/batched_gemm.h"
+#include "../../Common/benchmark.h"
+#include "../../Common/coro.h"
+#include "../../Common/factorize.h"
+#include "../../Common/perf_counters.h"
+#include "../../Common/philox.h"
+#include "../../Common/policy.h"
 
 using namespace std;
 using namespace std::chrono;
 
+// Rows and the results of every operation come from the matrix's memory
+// resource (the default heap unless one is given). Copies start on the
+// default heap again, so a copy may outlive an arena the original lives in.
+template<typename T>
 class Matrix {
 private:
-	vector<vector<double>> data;
+	pmr::vector<pmr::vector<T>> data;
 	int rows, cols;
 
 public:
-	Matrix(int r = 0, int c = 0) : rows(r), cols(c), data(r, vector<double>(c)) {}
+	Matrix(int r = 0, int c = 0, pmr::memory_resource* resource = pmr::get_default_resource())
+		: data(r, resource), rows(r), cols(c) {
+		for (auto& row : data) row.resize(c);
+	}
+
+	// Copy of other whose rows live in resource.
+	Matrix(const Matrix& other, pmr::memory_resource* resource)
+		: data(other.data, resource), rows(other.rows), cols(other.cols) {}
 
-	void random_fill() {
-		random_device rd;
-		mt19937 gen(rd());
-		uniform_real_distribution<> dis(-10.0, 10.0);
+	pmr::memory_resource* resource() const { return data.get_allocator().resource(); }
 
-		for (auto& row : data) {
-			for (auto& elem : row) {
-				elem = dis(gen);
+	// Element (i, j) is number i * cols + j of the seed's sequence, so the
+	// result is the same for any thread count.
+	void random_fill(uint64_t seed, int thread_count = thread::hardware_concurrency()) {
+		const rng::Philox4x32 gen(seed);
+		pmr::vector<thread> threads(resource());
+		if (thread_count < 1) thread_count = 1;
+
+		auto worker = [&](int start_row, int end_row) {
+			for (int i = start_row; i < end_row; ++i) {
+				rng::uniform_real(gen, (uint64_t)i * cols, data[i].data(), cols, -10.0, 10.0);
 			}
+			};
+
+		int rows_per_thread = rows / thread_count;
+		for (int t = 0; t < thread_count; ++t) {
+			int start = t * rows_per_thread;
+			int end = (t == thread_count - 1) ? rows : start + rows_per_thread;
+			threads.emplace_back(worker, start, end);
 		}
+
+		for (auto& t : threads) t.join();
 	}
 
 	void print() const {
@@ -39,7 +76,7 @@ public:
 	}
 
 	Matrix add_sequential(const Matrix& other) const {
-		Matrix result(rows, cols);
+		Matrix result(rows, cols, resource());
 		for (int i = 0; i < rows; ++i) {
 			for (int j = 0; j < cols; ++j) {
 				result.data[i][j] = data[i][j] + other.data[i][j];
@@ -49,7 +86,8 @@ public:
 	}
 
 	Matrix multiply_sequential(const Matrix& other) const {
-		Matrix result(rows, other.cols);
+		Matrix result(rows, other.cols, resource());
+		perf::Region region("multiply_sequential", 2.0 * rows * cols * other.cols);
 		for (int i = 0; i < rows; ++i) {
 			for (int j = 0; j < other.cols; ++j) {
 				for (int k = 0; k < cols; ++k) {
@@ -61,8 +99,8 @@ public:
 	}
 
 	Matrix add_parallel_threads(int thread_count) const {
-		Matrix result(rows, cols);
-		vector<thread> threads;
+		Matrix result(rows, cols, resource());
+		pmr::vector<thread> threads(resource());
 
 		auto worker = [&](int start_row, int end_row) {
 			for (int i = start_row; i < end_row; ++i) {
@@ -84,10 +122,12 @@ public:
 	}
 
 	Matrix multiply_parallel_threads(const Matrix& other, int thread_count) const {
-		Matrix result(rows, other.cols);
-		vector<thread> threads;
+		Matrix result(rows, other.cols, resource());
+		pmr::vector<thread> threads(resource());
+		const char* region_name = "multiply_parallel_threads";
 
-		auto worker = [&](int start_row, int end_row) {
+		auto worker = [&](int start_row, int end_row, int worker_id) {
+			perf::Region region(region_name, 2.0 * (end_row - start_row) * cols * other.cols, worker_id);
 			for (int i = start_row; i < end_row; ++i) {
 				for (int j = 0; j < other.cols; ++j) {
 					for (int k = 0; k < cols; ++k) {
@@ -101,7 +141,7 @@ public:
 		for (int t = 0; t < thread_count; ++t) {
 			int start = t * rows_per_thread;
 			int end = (t == thread_count - 1) ? rows : start + rows_per_thread;
-			threads.emplace_back(worker, start, end);
+			threads.emplace_back(worker, start, end, t);
 		}
 
 		for (auto& t : threads) t.join();
@@ -109,8 +149,8 @@ public:
 	}
 
 	Matrix add_parallel_async(int thread_count) const {
-		Matrix result(rows, cols);
-		vector<future<void>> futures;
+		Matrix result(rows, cols, resource());
+		pmr::vector<future<void>> futures(resource());
 
 		auto worker = [&](int start_row, int end_row) {
 			for (int i = start_row; i < end_row; ++i) {
@@ -132,10 +172,12 @@ public:
 	}
 
 	Matrix multiply_parallel_async(const Matrix& other, int thread_count) const {
-		Matrix result(rows, other.cols);
-		vector<future<void>> futures;
+		Matrix result(rows, other.cols, resource());
+		pmr::vector<future<void>> futures(resource());
+		const char* region_name = "multiply_parallel_async";
 
-		auto worker = [&](int start_row, int end_row) {
+		auto worker = [&](int start_row, int end_row, int worker_id) {
+			perf::Region region(region_name, 2.0 * (end_row - start_row) * cols * other.cols, worker_id);
 			for (int i = start_row; i < end_row; ++i) {
 				for (int j = 0; j < other.cols; ++j) {
 					for (int k = 0; k < cols; ++k) {
@@ -149,13 +191,104 @@ public:
 		for (int t = 0; t < thread_count; ++t) {
 			int start = t * rows_per_thread;
 			int end = (t == thread_count - 1) ? rows : start + rows_per_thread;
-			futures.push_back(async(launch::async, worker, start, end));
+			futures.push_back(async(launch::async, worker, start, end, t));
 		}
 
 		for (auto& f : futures) f.wait();
 		return result;
 	}
 
+	// Row blocks as tasks on a shared pool. The caller's coroutine resumes
+	// after the last block instead of blocking a thread in wait().
+	pc::task<Matrix> add_parallel_coroutine(pc::ThreadPool& pool, int block_count) const {
+		Matrix result(rows, cols, resource());
+		vector<pc::task<void>> blocks;
+
+		int rows_per_block = rows / block_count;
+		for (int t = 0; t < block_count; ++t) {
+			int start = t * rows_per_block;
+			int end = (t == block_count - 1) ? rows : start + rows_per_block;
+			blocks.push_back(pc::run_on(pool, [this, &result, start, end] {
+				for (int i = start; i < end; ++i) {
+					for (int j = 0; j < cols; ++j) {
+						result.data[i][j] = data[i][j] + data[i][j];
+					}
+				}
+				}));
+		}
+
+		co_await pc::when_all(std::move(blocks));
+		co_return result;
+	}
+
+	pc::task<Matrix> multiply_parallel_coroutine(pc::ThreadPool& pool, const Matrix& other, int block_count) const {
+		Matrix result(rows, other.cols, resource());
+		vector<pc::task<void>> blocks;
+
+		int rows_per_block = rows / block_count;
+		for (int t = 0; t < block_count; ++t) {
+			int start = t * rows_per_block;
+			int end = (t == block_count - 1) ? rows : start + rows_per_block;
+			blocks.push_back(pc::run_on(pool, [this, &result, &other, start, end, t] {
+				perf::Region region("multiply_parallel_coroutine", 2.0 * (end - start) * cols * other.cols, t);
+				for (int i = start; i < end; ++i) {
+					for (int j = 0; j < other.cols; ++j) {
+						for (int k = 0; k < cols; ++k) {
+							result.data[i][j] += data[i][k] * other.data[k][j];
+						}
+					}
+				}
+				}));
+		}
+
+		co_await pc::when_all(std::move(blocks));
+		co_return result;
+	}
+
+	// Same product with B transposed first, so the inner loop runs along two
+	// rows instead of down a column of B.
+	Matrix multiply_transposed(pc::ThreadPool& pool, const Matrix& other) const {
+		const Matrix bt = other.transpose(pool);
+		Matrix result(rows, other.cols, resource());
+		auto kernel = [&](auto leaf, long long begin, long long end) {
+			perf::Region region("multiply_transposed", 2.0 * (end - begin) * cols * other.cols);
+			for (long long i = begin; i < end; ++i) {
+				for (int j = 0; j < other.cols; ++j) {
+					result.data[i][j] = pc::dot(leaf, data[i].data(), bt.data[j].data(), cols);
+				}
+			}
+			return end - begin;
+		};
+		pc::run_range<long long>(pc::threads(pool, pc::simd), 0, rows, kernel);
+		return result;
+	}
+
+	Matrix transpose(pc::ThreadPool& pool) const {
+		Matrix result(cols, rows, resource());
+		pc::transpose(pc::threads(pool, pc::simd), *this, result);
+		return result;
+	}
+
+	// Square matrices are transposed in place, others through a copy.
+	void transpose_in_place(pc::ThreadPool& pool) {
+		if (rows == cols) pc::transpose_in_place(pc::threads(pool, pc::simd), *this);
+		else *this = transpose(pool);
+	}
+
+	// A * x.
+	pmr::vector<T> multiply_vector(pc::ThreadPool& pool, span<const T> x) const {
+		pmr::vector<T> y(rows, resource());
+		pc::gemv(pc::threads(pool, pc::simd), *this, x.data(), y.data());
+		return y;
+	}
+
+	// x^T * A.
+	pmr::vector<T> vector_multiply(pc::ThreadPool& pool, span<const T> x) const {
+		pmr::vector<T> y(cols, resource());
+		pc::gevm(pc::threads(pool, pc::simd), *this, x.data(), y.data());
+		return y;
+	}
+
 	static DWORD WINAPI add_worker_winapi(LPVOID param) {
 		auto* args = reinterpret_cast<tuple<Matrix*, const Matrix*, int, int>*>(param);
 		Matrix* result = get<0>(*args);
@@ -172,9 +305,10 @@ public:
 	}
 
 	Matrix add_parallel_winapi(int thread_count) const {
-		Matrix result(rows, cols);
-		vector<HANDLE> threads;
-		vector<tuple<Matrix*, const Matrix*, int, int>> args;
+		Matrix result(rows, cols, resource());
+		pmr::vector<HANDLE> threads(resource());
+		pmr::vector<tuple<Matrix*, const Matrix*, int, int>> args(resource());
+		args.reserve(thread_count);
 
 		int rows_per_thread = rows / thread_count;
 		for (int t = 0; t < thread_count; ++t) {
@@ -191,60 +325,457 @@ public:
 
 	int get_rows() const { return rows; }
 	int get_cols() const { return cols; }
+
+	T* row(int i) { return data[i].data(); }
+	const T* row(int i) const { return data[i].data(); }
 };
 
-void test_operations(const Matrix& a, const Matrix& b, int thread_count) {
-	auto start = high_resolution_clock::now();
-	auto c_seq_add = a.add_sequential(b);
-	auto end = high_resolution_clock::now();
-	cout << "Sequential add: " << duration_cast<milliseconds>(end - start).count() << " ms\n";
+// Copy of m rounded to element type To.
+template<typename To, typename From>
+Matrix<To> convert(const Matrix<From>& m) {
+	Matrix<To> result(m.get_rows(), m.get_cols(), m.resource());
+	for (int i = 0; i < m.get_rows(); ++i) {
+		for (int j = 0; j < m.get_cols(); ++j) {
+			result.row(i)[j] = To(m.row(i)[j]);
+		}
+	}
+	return result;
+}
 
-	start = high_resolution_clock::now();
-	auto c_thread_add = a.add_parallel_threads(thread_count);
-	end = high_resolution_clock::now();
-	cout << "Threads add: " << duration_cast<milliseconds>(end - start).count() << " ms\n";
+void multiply_tuned(pc::ThreadPool& pool, const tune::Config& config, const Matrix<double>& a, const Matrix<double>& b, Matrix<double>& c) {
+	const pc::GemmTiles tiles{ (int)config.get("tile_k", 0), (int)config.get("tile_j", 0) };
+	const int grain = (int)config.get("grain", 1);
+	switch (config.get("simd_width", 2)) {
+	case 4: pc::gemm(pc::threads(pool, pc::avx, grain), a, b, c, tiles); break;
+	case 2: pc::gemm(pc::threads(pool, pc::simd, grain), a, b, c, tiles); break;
+	default: pc::gemm(pc::threads(pool, pc::seq, grain), a, b, c, tiles); break;
+	}
+}
 
-	start = high_resolution_clock::now();
-	auto c_async_add = a.add_parallel_async(thread_count);
-	end = high_resolution_clock::now();
-	cout << "Async add: " << duration_cast<milliseconds>(end - start).count() << " ms\n";
+// Thread count, chunks per thread, cache tiles and vector width (scalar,
+// SSE or AVX) for the policy multiply. Searched once per machine and size
+// bucket, then read from the tune cache.
+tune::Config tune_multiply(tune::Tuner& tuner, const Matrix<double>& a, const Matrix<double>& b) {
+	const vector<tune::Param> space = {
+		{ "threads", tune::thread_candidates() },
+		{ "grain", { 1, 2, 4, 8 } },
+		{ "tile_k", { 0, 64, 128, 256 } },
+		{ "tile_j", { 0, 256, 512, 1024 } },
+		{ "simd_width", tune::simd_width_candidates(sizeof(double)) },
+	};
+	Matrix<double> c(a.get_rows(), b.get_cols());
+	return tuner.tune("ParaComp2.multiply", a.get_rows(), space, [&](const tune::Config& config) {
+		pc::ThreadPool pool((int)config.get("threads", 1));
+		return tune::time_min_ms([&] { multiply_tuned(pool, config, a, b, c); });
+		});
+}
 
-	start = high_resolution_clock::now();
-	auto c_winapi_add = a.add_parallel_winapi(thread_count);
-	end = high_resolution_clock::now();
-	cout << "WinAPI add: " << duration_cast<milliseconds>(end - start).count() << " ms\n";
+// Threads for the element-wise add. It is bound by memory bandwidth, so on
+// small matrices fewer threads than cores usually win.
+tune::Config tune_add(tune::Tuner& tuner, const Matrix<double>& a) {
+	const vector<tune::Param> space = { { "threads", tune::thread_candidates() } };
+	return tuner.tune("ParaComp2.add", a.get_rows(), space, [&](const tune::Config& config) {
+		return tune::time_min_ms([&] { a.add_parallel_threads((int)config.get("threads", 1)); });
+		});
+}
 
-	start = high_resolution_clock::now();
-	auto c_seq_mul = a.multiply_sequential(b);
-	end = high_resolution_clock::now();
-	cout << "Sequential multiply: " << duration_cast<milliseconds>(end - start).count() << " ms\n";
+// 4 / (1 + x^2), whose integral over [0, 1] is pi. The __m128d overload
+// lets the simd integration evaluate two points at once.
+struct pi_integrand {
+	double operator()(double x) const { return 4.0 / (1.0 + x * x); }
+	__m128d operator()(__m128d x) const { return _mm_div_pd(_mm_set1_pd(4.0), _mm_add_pd(_mm_set1_pd(1.0), _mm_mul_pd(x, x))); }
+};
 
-	start = high_resolution_clock::now();
-	auto c_thread_mul = a.multiply_parallel_threads(b, thread_count);
-	end = high_resolution_clock::now();
-	cout << "Threads multiply: " << duration_cast<milliseconds>(end - start).count() << " ms\n";
+double integrate_tuned(pc::ThreadPool& pool, const tune::Config& config, long long n) {
+	return pc::integrate(pc::threads(pool, pc::simd, (int)config.get("grain", 1)), pc::rectangle, pi_integrand(), 0.0, 1.0, n);
+}
 
-	start = high_resolution_clock::now();
-	auto c_async_mul = a.multiply_parallel_async(b, thread_count);
-	end = high_resolution_clock::now();
-	cout << "Async multiply: " << duration_cast<milliseconds>(end - start).count() << " ms\n";
+// Threads and pieces per thread for the pi integration, per bucket of n.
+tune::Config tune_integrate(tune::Tuner& tuner, long long n) {
+	const vector<tune::Param> space = {
+		{ "threads", tune::thread_candidates() },
+		{ "grain", { 1, 2, 4, 8 } },
+	};
+	return tuner.tune("ParaComp2.integrate", n, space, [&](const tune::Config& config) {
+		pc::ThreadPool pool((int)config.get("threads", 1));
+		return tune::time_min_ms([&] { integrate_tuned(pool, config, n); });
+		});
 }
 
-int main() {
-	const int rows = 500;
-	const int cols = 500;
-	const int thread_count = thread::hardware_concurrency();
+void test_operations(bench::Suite& suite, const Matrix<double>& a, const Matrix<double>& b,
+	const vector<long long>& add_thread_counts, const vector<long long>& thread_counts, const tune::Config& tuned) {
+	const long long size = a.get_rows();
+	const double add_bytes = 3.0 * a.get_rows() * a.get_cols() * sizeof(double);
+	const double mul_flops = 2.0 * a.get_rows() * a.get_cols() * b.get_cols();
+	const string seq_params = bench::params({ { "size", size } });
 
-	Matrix a(rows, cols);
-	Matrix b(rows, cols);
+	suite.run("add_sequential", seq_params, bench::bytes(add_bytes), [&] { a.add_sequential(b); });
+	suite.run("multiply_sequential", seq_params, bench::flops(mul_flops), [&] { a.multiply_sequential(b); });
 
-	a.random_fill();
-	b.random_fill();
+	for (long long threads : add_thread_counts) {
+		const int thread_count = (int)threads;
+		const string params = bench::params({ { "size", size }, { "threads", threads } });
 
-	cout << "Testing with " << thread_count << " threads\n";
-	cout << "Matrix size: " << rows << "x" << cols << "\n\n";
+		suite.run("add_threads", params, bench::bytes(add_bytes), [&] { a.add_parallel_threads(thread_count); });
+		suite.run("add_async", params, bench::bytes(add_bytes), [&] { a.add_parallel_async(thread_count); });
+		suite.run("add_winapi", params, bench::bytes(add_bytes), [&] { a.add_parallel_winapi(thread_count); });
 
-	test_operations(a, b, thread_count);
+		pc::ThreadPool task_pool(thread_count);
+		suite.run("add_coroutine", params, bench::bytes(add_bytes), [&] { pc::sync_wait(a.add_parallel_coroutine(task_pool, thread_count)); });
+	}
+
+	for (long long threads : thread_counts) {
+		const int thread_count = (int)threads;
+		const string params = bench::params({ { "size", size }, { "threads", threads } });
+
+		suite.run("multiply_threads", params, bench::flops(mul_flops), [&] { a.multiply_parallel_threads(b, thread_count); });
+		suite.run("multiply_async", params, bench::flops(mul_flops), [&] { a.multiply_parallel_async(b, thread_count); });
+
+		pc::ThreadPool task_pool(thread_count);
+		suite.run("multiply_coroutine", params, bench::flops(mul_flops), [&] { pc::sync_wait(a.multiply_parallel_coroutine(task_pool, b, thread_count)); });
+
+		pc::ThreadPool pool(thread_count);
+		Matrix<double> c(a.get_rows(), b.get_cols());
+		suite.run("multiply_policy", params + " policy=threads+simd", bench::flops(mul_flops), [&] { pc::gemm(pc::threads(pool, pc::simd), a, b, c); });
+	}
+
+	pc::ThreadPool tuned_pool((int)tuned.get("threads", 1));
+	Matrix<double> c(a.get_rows(), b.get_cols());
+	suite.run("multiply_tuned", seq_params + " " + tuned.to_string(), bench::flops(mul_flops), [&] { multiply_tuned(tuned_pool, tuned, a, b, c); });
+}
+
+// The thread and policy variants in single precision and with 16-bit
+// storage, which halve and quarter the bytes moved per element.
+void test_precisions(bench::Suite& suite, const Matrix<double>& a, const Matrix<double>& b, int thread_count) {
+	const long long size = a.get_rows();
+	const double elements = (double)a.get_rows() * a.get_cols();
+	const double mul_flops = 2.0 * a.get_rows() * a.get_cols() * b.get_cols();
+	const string params = bench::params({ { "size", size }, { "threads", thread_count } });
+	const string policy_params = params + " policy=threads+simd";
+
+	const Matrix<float> af = convert<float>(a), bf = convert<float>(b);
+	suite.run("add_threads", params + " type=float", bench::bytes(3.0 * elements * sizeof(float)), [&] { af.add_parallel_threads(thread_count); });
+	suite.run("multiply_threads", params + " type=float", bench::flops(mul_flops), [&] { af.multiply_parallel_threads(bf, thread_count); });
+
+	pc::ThreadPool pool(thread_count);
+	Matrix<float> c(a.get_rows(), b.get_cols());
+	suite.run("multiply_policy", policy_params + " type=float", bench::flops(mul_flops), [&] { pc::gemm(pc::threads(pool, pc::simd), af, bf, c); });
+
+	const Matrix<pc::half> ah = convert<pc::half>(a), bh = convert<pc::half>(b);
+	suite.run("multiply_policy", policy_params + " type=fp16", bench::flops(mul_flops), [&] { pc::gemm(pc::threads(pool, pc::simd), ah, bh, c); });
+
+	const Matrix<pc::bfloat16> ab = convert<pc::bfloat16>(a), bb = convert<pc::bfloat16>(b);
+	suite.run("multiply_policy", policy_params + " type=bf16", bench::flops(mul_flops), [&] { pc::gemm(pc::threads(pool, pc::simd), ab, bb, c); });
+}
+
+// pi by the midpoint rule, one task per block of the interval.
+pc::task<double> integrate_coroutine(pc::ThreadPool& pool, long long n, int block_count) {
+	vector<pc::task<double>> blocks;
+	for (int t = 0; t < block_count; ++t) {
+		double lo = double(t) / block_count, hi = double(t + 1) / block_count;
+		blocks.push_back(pc::run_on(pool, [lo, hi, n, block_count] {
+			return pc::integrate(pc::simd, pc::rectangle, pi_integrand(), lo, hi, n / block_count);
+			}));
+	}
+	vector<double> parts = co_await pc::when_all(std::move(blocks));
+	co_return accumulate(parts.begin(), parts.end(), 0.0);
+}
+
+pc::task<void> multiply_request(pc::ThreadPool& pool, const Matrix<double>& a, const Matrix<double>& b, int block_count) {
+	co_await a.multiply_parallel_coroutine(pool, b, block_count);
+}
+
+pc::task<void> integrate_request(pc::ThreadPool& pool, long long n, int block_count, double& pi) {
+	pi = co_await integrate_coroutine(pool, n, block_count);
+}
+
+// A burst of independent requests. With std::async every request starts
+// thread_count fresh threads; as coroutines they all share one pool, and
+// integrations interleave with the matrix products on the same threads.
+// Integrations are split into the tuned number of pieces for n.
+void test_requests(bench::Suite& suite, tune::Tuner& tuner, const Matrix<double>& a, const Matrix<double>& b, int thread_count) {
+	const int request_count = (int)suite.options().get_int("requests", 16);
+	const long long n = suite.options().get_int("integrate-n", 10000000);
+	const tune::Config tuned_integrate = tune_integrate(tuner, n);
+	const int integrate_blocks = (int)(tuned_integrate.get("threads", 1) * tuned_integrate.get("grain", 1));
+	pc::ThreadPool integrate_pool((int)tuned_integrate.get("threads", 1));
+	double tuned_pi = 0.0;
+	suite.run("integrate_tuned", bench::params({ { "n", n } }) + " " + tuned_integrate.to_string(), bench::evals((double)n), [&] {
+		tuned_pi = integrate_tuned(integrate_pool, tuned_integrate, n);
+		});
+	cout << "Tuned pi: " << tuned_pi << "\n";
+	const double mul_flops = 2.0 * a.get_rows() * a.get_cols() * b.get_cols();
+	const string params = bench::params({ { "size", a.get_rows() }, { "threads", thread_count }, { "requests", request_count } });
+
+	suite.run("requests_async", params, bench::flops(request_count * mul_flops), [&] {
+		vector<future<Matrix<double>>> requests;
+		for (int r = 0; r < request_count; ++r) {
+			requests.push_back(async(launch::async, [&] { return a.multiply_parallel_async(b, thread_count); }));
+		}
+		for (auto& f : requests) f.wait();
+		});
+
+	pc::ThreadPool pool(thread_count);
+	suite.run("requests_coroutine", params, bench::flops(request_count * mul_flops), [&] {
+		vector<pc::task<void>> requests;
+		for (int r = 0; r < request_count; ++r) requests.push_back(multiply_request(pool, a, b, thread_count));
+		pc::sync_wait(pc::when_all(std::move(requests)));
+		});
+
+	vector<double> pi(request_count);
+	suite.run("requests_mixed", params + " " + bench::params({ { "n", n } }), bench::none(), [&] {
+		vector<pc::task<void>> requests;
+		for (int r = 0; r < request_count; ++r) {
+			if (r % 2 == 0) requests.push_back(multiply_request(pool, a, b, thread_count));
+			else requests.push_back(integrate_request(pool, n, integrate_blocks, pi[r]));
+		}
+		pc::sync_wait(pc::when_all(std::move(requests)));
+		});
+	if (request_count > 1) cout << "Coroutine pi: " << pi[1] << "\n";
+}
+
+// Solves A x = b for x = (1, 2, ..., n) and returns max |x - expected|.
+template<typename Solve>
+double solve_error(const Matrix<double>& a, Solve solve) {
+	const int n = a.get_rows();
+	vector<double> b(n, 0.0);
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < n; ++j) b[i] += a.row(i)[j] * (j + 1);
+	}
+	solve(b);
+	double error = 0.0;
+	for (int i = 0; i < n; ++i) error = max(error, fabs(b[i] - (i + 1)));
+	return error;
+}
+
+// Transposes, matrix-vector products and the transposed-B multiply on the
+// thread pool, checked against plain loops and gemm.
+void test_matvec(bench::Suite& suite, const Matrix<double>& a, const Matrix<double>& b, int thread_count) {
+	const int n = a.get_rows();
+	const string params = bench::params({ { "size", n }, { "threads", thread_count } });
+	const double bytes = (double)n * n * sizeof(double);
+	pc::ThreadPool pool(thread_count);
+
+	Matrix<double> product;
+	suite.run("multiply_transposed", params, bench::flops(2.0 * n * n * n), [&] { product = a.multiply_transposed(pool, b); });
+	Matrix<double> at;
+	suite.run("transpose", params, bench::bytes(2 * bytes), [&] { at = a.transpose(pool); });
+	Matrix<double> square = a;
+	suite.run("transpose_in_place", params, bench::bytes(2 * bytes), [&] { square.transpose_in_place(pool); });
+
+	square = a;
+	square.transpose_in_place(pool);
+	bool transpose_ok = true;
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < n; ++j) transpose_ok = transpose_ok && at.row(j)[i] == a.row(i)[j] && square.row(j)[i] == a.row(i)[j];
+	}
+
+	vector<double> x(n);
+	for (int i = 0; i < n; ++i) x[i] = 1.0 / (1 + i % 10);
+	pmr::vector<double> ax, xa;
+	suite.run("gemv", params, bench::bytes(bytes), [&] { ax = a.multiply_vector(pool, x); });
+	suite.run("gevm", params, bench::bytes(bytes), [&] { xa = a.vector_multiply(pool, x); });
+
+	Matrix<double> expected(n, n);
+	pc::gemm(pc::threads(pool, pc::simd), a, b, expected);
+	double product_error = 0.0, gemv_error = 0.0, gevm_error = 0.0;
+	vector<double> ax_ref(n, 0.0), xa_ref(n, 0.0);
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < n; ++j) {
+			product_error = max(product_error, fabs(product.row(i)[j] - expected.row(i)[j]));
+			ax_ref[i] += a.row(i)[j] * x[j];
+			xa_ref[j] += x[i] * a.row(i)[j];
+		}
+	}
+	for (int i = 0; i < n; ++i) {
+		gemv_error = max(gemv_error, fabs(ax[i] - ax_ref[i]));
+		gevm_error = max(gevm_error, fabs(xa[i] - xa_ref[i]));
+	}
+
+	cout << "Transpose: " << (transpose_ok ? "ok" : "MISMATCH") << "\n";
+	cout << "multiply_transposed max difference: " << product_error << "\n";
+	cout << "GEMV max difference: " << gemv_error << ", GEVM max difference: " << gevm_error << "\n";
+}
+
+// Tiled LU and Cholesky with the DAG scheduler against the same tile tasks
+// run in fork-join stages. The timed body includes copying the input.
+void test_factorizations(bench::Suite& suite, const Matrix<double>& a, int thread_count) {
+	const int n = a.get_rows();
+	const int tile = (int)suite.options().get_int("factor-tile", 64);
+	const string params = bench::params({ { "size", n }, { "threads", thread_count }, { "tile", tile } });
+	const double n3 = (double)n * n * n;
+	pc::ThreadPool pool(thread_count);
+
+	// A * A^T + n * I is symmetric positive definite.
+	const Matrix<double> at = a.transpose(pool);
+	Matrix<double> spd(n, n);
+	pc::gemm(pc::threads(pool, pc::simd), a, at, spd);
+	for (int i = 0; i < n; ++i) spd.row(i)[i] += n;
+
+	vector<int> pivots;
+	Matrix<double> lu, l;
+	const pair<const char*, pc::Schedule> schedules[] = { { "dag", pc::Schedule::dag }, { "fork_join", pc::Schedule::fork_join } };
+	for (const auto& s : schedules) {
+		suite.run(string("lu_") + s.first, params, bench::flops(2.0 * n3 / 3.0), [&] {
+			lu = a;
+			pc::lu_factorize(pool, lu, pivots, tile, s.second);
+			});
+		suite.run(string("cholesky_") + s.first, params, bench::flops(n3 / 3.0), [&] {
+			l = spd;
+			pc::cholesky_factorize(pool, l, tile, s.second);
+			});
+	}
+
+	cout << "LU solve error: " << solve_error(a, [&](vector<double>& b) { pc::lu_solve(lu, pivots, b); }) << "\n";
+	cout << "Cholesky solve error: " << solve_error(spd, [&](vector<double>& b) { pc::cholesky_solve(l, b); }) << "\n";
+}
+
+// Many small products: one Matrix object per product against the batched
+// kernels on contiguous buffers, packed and interleaved. Sizes and the batch
+// are swept separately from --size; each batch holds about --batch-elements
+// elements per operand.
+void test_batched(bench::Suite& suite, int thread_count) {
+	const vector<long long> sizes = suite.options().get_list("batch-sizes", { 4, 8, 16, 32 });
+	const long long elements = suite.options().get_int("batch-elements", 1 << 22);
+	pc::ThreadPool pool(thread_count);
+
+	for (long long size : sizes) {
+		const int n = (int)size;
+		const long long count = max(1LL, elements / (n * n));
+		const long long object_count = min(count, 10000LL);
+		const size_t matrix_size = (size_t)n * n;
+		const double mul_flops = 2.0 * n * n * n;
+		const string params = bench::params({ { "size", n }, { "threads", thread_count }, { "count", count } });
+
+		vector<double> a(count * matrix_size), b(count * matrix_size), c(count * matrix_size), check(count * matrix_size);
+		rng::uniform_real(rng::Philox4x32(1), 0, a.data(), a.size(), -10.0, 10.0);
+		rng::uniform_real(rng::Philox4x32(2), 0, b.data(), b.size(), -10.0, 10.0);
+
+		vector<Matrix<double>> ma(object_count, Matrix<double>(n, n)), mb(object_count, Matrix<double>(n, n)), mc(object_count);
+		for (long long m = 0; m < object_count; ++m) {
+			for (int i = 0; i < n; ++i) {
+				copy_n(a.data() + m * matrix_size + (size_t)i * n, n, ma[m].row(i));
+				copy_n(b.data() + m * matrix_size + (size_t)i * n, n, mb[m].row(i));
+			}
+		}
+		suite.run("batched_objects", bench::params({ { "size", n }, { "count", object_count } }), bench::flops(object_count * mul_flops), [&] {
+			for (long long m = 0; m < object_count; ++m) mc[m] = ma[m].multiply_sequential(mb[m]);
+			});
+
+		suite.run("batched_packed", params, bench::flops(count * mul_flops), [&] {
+			pc::batched_gemm(pc::threads(pool, pc::simd), n, a.data(), b.data(), c.data(), count, pc::Layout::packed);
+			});
+
+		const vector<double> ai = pc::interleave(a.data(), count, n, n), bi = pc::interleave(b.data(), count, n, n);
+		vector<double> ci(ai.size());
+		suite.run("batched_interleaved", params, bench::flops(count * mul_flops), [&] {
+			pc::batched_gemm(pc::threads(pool, pc::simd), n, ai.data(), bi.data(), ci.data(), count, pc::Layout::interleaved);
+			});
+		pc::deinterleave(ci.data(), count, n, n, check.data());
+
+		double error = 0.0;
+		for (size_t e = 0; e < c.size(); ++e) error = max(error, fabs(c[e] - check[e]));
+		for (long long m = 0; m < object_count; ++m) {
+			for (int i = 0; i < n; ++i) {
+				for (int j = 0; j < n; ++j) error = max(error, fabs(mc[m].row(i)[j] - c[m * matrix_size + (size_t)i * n + j]));
+			}
+		}
+		cout << "Batched " << n << "x" << n << " max difference: " << error << "\n";
+	}
+}
+
+// Short-lived temporaries from several threads at once: every
+// add_sequential() allocates its result row by row. The same work runs on
+// the default heap, a shared PoolResource and a per-thread Arena rewound
+// after each operation, with --huge-pages on 2 MiB pages.
+void test_allocators(bench::Suite& suite, int thread_count) {
+	const int n = (int)suite.options().get_int("alloc-size", 64);
+	const int ops = (int)suite.options().get_int("alloc-ops", 2000);
+	const bool huge = suite.options().has("huge-pages");
+	const string params = bench::params({ { "size", n }, { "threads", thread_count }, { "ops", ops } });
+	const bench::Throughput items = bench::items((double)ops * thread_count);
+
+	Matrix<double> x(n, n), y(n, n);
+	x.random_fill(3, 1);
+	y.random_fill(4, 1);
+
+	auto run_threads = [&](auto worker) {
+		vector<thread> threads;
+		for (int t = 0; t < thread_count; ++t) threads.emplace_back(worker);
+		for (auto& t : threads) t.join();
+	};
+	auto add_loop = [&](const Matrix<double>& a, const Matrix<double>& b, auto after_each) {
+		double sum = 0.0;
+		for (int op = 0; op < ops; ++op) {
+			{
+				Matrix<double> c = a.add_sequential(b);
+				sum += c.row(n - 1)[n - 1];
+			}
+			after_each();
+		}
+		volatile double sink = sum;
+		(void)sink;
+	};
+
+	suite.run("alloc_heap", params, items, [&] {
+		run_threads([&] { add_loop(x, y, [] {}); });
+		});
+
+	pc::PoolResource pool;
+	suite.run("alloc_pool", params, items, [&] {
+		run_threads([&] {
+			Matrix<double> a(x, &pool), b(y, &pool);
+			add_loop(a, b, [] {});
+			});
+		});
+
+	pmr::memory_resource* upstream = huge ? pc::huge_pages() : pmr::get_default_resource();
+	suite.run("alloc_arena", params + (huge ? " huge_pages=1" : ""), items, [&] {
+		run_threads([&] {
+			pc::Arena arena(4 << 20, upstream);
+			Matrix<double> a(x, &arena), b(y, &arena);
+			const pc::Arena::Checkpoint operands = arena.checkpoint();
+			add_loop(a, b, [&] { arena.reset(operands); });
+			});
+		});
+
+	if (huge) {
+		cout << "Huge pages: " << pc::huge_pages()->huge_page_bytes() / 1048576.0 << " MB explicit, "
+			<< pc::huge_pages()->fallback_bytes() / 1048576.0 << " MB ordinary or transparent\n";
+	}
+}
+
+int main(int argc, char** argv) {
+	bench::Suite suite("ParaComp2", argc, argv);
+	const vector<long long> sizes = suite.options().get_list("size", { 500 });
+	tune::Tuner tuner(suite.options().get_string("tune-cache", tune::default_cache_path()), suite.options().has("retune"));
+
+	for (long long size : sizes) {
+		Matrix<double> a((int)size, (int)size);
+		Matrix<double> b((int)size, (int)size);
+
+		a.random_fill(1);
+		b.random_fill(2);
+
+		cout << "Matrix size: " << size << "x" << size << "\n";
+		const tune::Config tuned = tune_multiply(tuner, a, b);
+		const tune::Config tuned_add = tune_add(tuner, a);
+		cout << "Tuned for " << tuner.machine() << ": multiply " << tuned.to_string() << ", add " << tuned_add.to_string() << "\n";
+
+		// Without --threads adds and multiplies each run at their tuned thread count.
+		const vector<long long> thread_counts = suite.options().get_list("threads", { tuned.get("threads", 1) });
+		const vector<long long> add_thread_counts = suite.options().get_list("threads", { tuned_add.get("threads", 1) });
+		test_operations(suite, a, b, add_thread_counts, thread_counts, tuned);
+		test_precisions(suite, a, b, (int)thread_counts.front());
+		test_requests(suite, tuner, a, b, (int)thread_counts.front());
+		test_factorizations(suite, a, (int)thread_counts.front());
+		test_matvec(suite, a, b, (int)thread_counts.front());
+		cout << "\n";
+	}
+	const int thread_count = max(1, (int)suite.options().get_list("threads", { (long long)thread::hardware_concurrency() }).front());
+	test_batched(suite, thread_count);
+	test_allocators(suite, thread_count);
 
-	return 0;
+	perf::report();
+	return suite.report();
 }
\ No newline at end of file
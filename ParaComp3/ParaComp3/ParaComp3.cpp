@@ -6,38 +6,67 @@
 #include <condition_variable>
 #include <atomic>
 #include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <shared_mutex>
+#include <random>
+#include <algorithm>
+#include <deque>
+#include <memory_resource>
+#include "../../Common/allocators.h"
+#include "../../Common/benchmark.h"
+#include "../../Common/perf_counters.h"
+#include "../../Common/sync_metrics.h"
 
 using namespace std;
 using namespace std::chrono;
 
 
+// Metrics are registered under the queue's name: <name>.lock.*, .depth
+// (size after each push), .enqueued, .dequeued, .empty_polls (failed
+// try_pop) and .pop_wait_ns (time wait_and_pop slept on an empty queue).
+// The queue's storage comes from resource.
 template<typename T>
 class ThreadSafeQueue {
 private:
-	queue<T> data_queue;
+	queue<T, pmr::deque<T>> data_queue;
 	mutable mutex mtx;
 	condition_variable cv;
+	metrics::LockMetrics lock_metrics;
+	metrics::Metric depth, enqueued, dequeued, empty_polls, pop_wait;
 
 public:
+	explicit ThreadSafeQueue(const string& name = "queue", pmr::memory_resource* resource = pmr::get_default_resource())
+		: data_queue(pmr::deque<T>(resource)), lock_metrics(name + ".lock"), depth(metrics::histogram(name + ".depth")),
+		enqueued(metrics::counter(name + ".enqueued")), dequeued(metrics::counter(name + ".dequeued")),
+		empty_polls(metrics::counter(name + ".empty_polls")), pop_wait(metrics::histogram(name + ".pop_wait_ns")) {}
+
 	void push(T value) {
-		lock_guard<mutex> lock(mtx);
+		metrics::TimedLock<mutex> lock(mtx, lock_metrics);
 		data_queue.push(move(value));
+		metrics::gauge(depth, data_queue.size());
+		metrics::add(enqueued);
 		cv.notify_one();
 	}
 
 	bool try_pop(T& value) {
-		lock_guard<mutex> lock(mtx);
-		if (data_queue.empty()) return false;
+		metrics::TimedLock<mutex> lock(mtx, lock_metrics);
+		if (data_queue.empty()) {
+			metrics::add(empty_polls);
+			return false;
+		}
 		value = move(data_queue.front());
 		data_queue.pop();
+		metrics::add(dequeued);
 		return true;
 	}
 
 	void wait_and_pop(T& value) {
-		unique_lock<mutex> lock(mtx);
-		cv.wait(lock, [this] { return !data_queue.empty(); });
+		metrics::TimedLock<mutex> lock(mtx, lock_metrics);
+		lock.wait(cv, [this] { return !data_queue.empty(); }, pop_wait);
 		value = move(data_queue.front());
 		data_queue.pop();
+		metrics::add(dequeued);
 	}
 
 	bool empty() const {
@@ -47,24 +76,180 @@ public:
 };
 
 
-void producer_consumer_cv() {
+// Lock-striped hash map: a fixed set of cache-line sized locks guards a bucket
+// array that grows by powers of two. Bucket i is always covered by stripe
+// i % stripe_count, so a resize only has to take every stripe once.
+template<typename K, typename V, typename Hash = hash<K>>
+class ConcurrentHashMap {
+private:
+	struct alignas(64) Stripe {
+		mutex mtx;
+		size_t count = 0;
+	};
+
+	using Bucket = vector<pair<K, V>>;
+
+	vector<Stripe> stripes;
+	vector<Bucket> buckets;
+	Hash hasher;
+	const size_t max_load = 4;
+
+	static size_t round_up_pow2(size_t n) {
+		size_t p = 1;
+		while (p < n) p <<= 1;
+		return p;
+	}
+
+	size_t stripe_of(size_t h) const { return h & (stripes.size() - 1); }
+	size_t bucket_of(size_t h) const { return h & (buckets.size() - 1); }
+
+	void resize(size_t seen_bucket_count) {
+		vector<unique_lock<mutex>> locks;
+		locks.reserve(stripes.size());
+		for (auto& s : stripes) locks.emplace_back(s.mtx);
+
+		if (buckets.size() != seen_bucket_count) return;
+
+		vector<Bucket> grown(buckets.size() * 2);
+		for (auto& bucket : buckets) {
+			for (auto& kv : bucket) {
+				grown[hasher(kv.first) & (grown.size() - 1)].push_back(move(kv));
+			}
+		}
+		buckets.swap(grown);
+	}
+
+public:
+	explicit ConcurrentHashMap(size_t stripe_count = 64, size_t bucket_count = 1024)
+		: stripes(round_up_pow2(stripe_count)),
+		buckets(max(round_up_pow2(bucket_count), round_up_pow2(stripe_count))) {}
+
+	bool insert_or_assign(const K& key, V value) {
+		size_t h = hasher(key);
+		Stripe& stripe = stripes[stripe_of(h)];
+		size_t seen_bucket_count;
+		bool grow;
+		{
+			lock_guard<mutex> lock(stripe.mtx);
+			Bucket& bucket = buckets[bucket_of(h)];
+			for (auto& kv : bucket) {
+				if (kv.first == key) {
+					kv.second = move(value);
+					return false;
+				}
+			}
+			bucket.emplace_back(key, move(value));
+			++stripe.count;
+			seen_bucket_count = buckets.size();
+			grow = stripe.count * stripes.size() > seen_bucket_count * max_load;
+		}
+		if (grow) resize(seen_bucket_count);
+		return true;
+	}
+
+	bool find(const K& key, V& value) const {
+		size_t h = hasher(key);
+		Stripe& stripe = const_cast<Stripe&>(stripes[stripe_of(h)]);
+		lock_guard<mutex> lock(stripe.mtx);
+		for (const auto& kv : buckets[bucket_of(h)]) {
+			if (kv.first == key) {
+				value = kv.second;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool erase(const K& key) {
+		size_t h = hasher(key);
+		Stripe& stripe = stripes[stripe_of(h)];
+		lock_guard<mutex> lock(stripe.mtx);
+		Bucket& bucket = buckets[bucket_of(h)];
+		for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+			if (it->first == key) {
+				*it = move(bucket.back());
+				bucket.pop_back();
+				--stripe.count;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	size_t size() const {
+		size_t total = 0;
+		for (auto& s : stripes) {
+			lock_guard<mutex> lock(const_cast<Stripe&>(s).mtx);
+			total += s.count;
+		}
+		return total;
+	}
+};
+
+// Baseline for the benchmark: one std::unordered_map behind a single
+// reader-writer lock.
+template<typename K, typename V>
+class LockedHashMap {
+private:
+	unordered_map<K, V> data;
+	mutable shared_timed_mutex mtx;
+
+public:
+	bool insert_or_assign(const K& key, V value) {
+		unique_lock<shared_timed_mutex> lock(mtx);
+		auto res = data.emplace(key, value);
+		if (!res.second) res.first->second = move(value);
+		return res.second;
+	}
+
+	bool find(const K& key, V& value) const {
+		shared_lock<shared_timed_mutex> lock(mtx);
+		auto it = data.find(key);
+		if (it == data.end()) return false;
+		value = it->second;
+		return true;
+	}
+
+	bool erase(const K& key) {
+		unique_lock<shared_timed_mutex> lock(mtx);
+		return data.erase(key) > 0;
+	}
+
+	size_t size() const {
+		shared_lock<shared_timed_mutex> lock(mtx);
+		return data.size();
+	}
+};
+
+
+// With verbose every event is printed; otherwise only the metrics are kept,
+// since printing under the lock serializes the threads it is measuring.
+void producer_consumer_cv(bool verbose) {
 	const int max_size = 5;
 	vector<int> buffer(max_size);
 	mutex mtx;
 	condition_variable not_full, not_empty;
 	int write_pos = 0, read_pos = 0, count = 0;
 	atomic<bool> done{ false };
+	const metrics::LockMetrics lock_metrics("pc_cv.lock");
+	const metrics::Metric depth = metrics::histogram("pc_cv.depth");
+	const metrics::Metric full_wait = metrics::histogram("pc_cv.not_full_wait_ns");
+	const metrics::Metric empty_wait = metrics::histogram("pc_cv.not_empty_wait_ns");
+	const metrics::Metric produced = metrics::counter("pc_cv.produced");
+	const metrics::Metric consumed = metrics::counter("pc_cv.consumed");
 
 	auto producer = [&](int id) {
 		for (int i = 0; i < 10; ++i) {
-			unique_lock<mutex> lock(mtx);
-			not_full.wait(lock, [&] { return count < max_size || done; });
+			metrics::TimedLock<mutex> lock(mtx, lock_metrics);
+			lock.wait(not_full, [&] { return count < max_size || done; }, full_wait);
 			if (done) break;
 
 			buffer[write_pos] = i;
 			write_pos = (write_pos + 1) % max_size;
 			++count;
-			cout << "Producer " << id << " produced " << i << endl;
+			metrics::gauge(depth, count);
+			metrics::add(produced);
+			if (verbose) cout << "Producer " << id << " produced " << i << endl;
 			lock.unlock();
 			not_empty.notify_one();
 			this_thread::sleep_for(milliseconds(100));
@@ -73,14 +258,16 @@ void producer_consumer_cv() {
 
 	auto consumer = [&](int id) {
 		while (!done || count > 0) {
-			unique_lock<mutex> lock(mtx);
-			not_empty.wait(lock, [&] { return count > 0 || done; });
+			metrics::TimedLock<mutex> lock(mtx, lock_metrics);
+			lock.wait(not_empty, [&] { return count > 0 || done; }, empty_wait);
 			if (count == 0 && done) break;
 
 			int value = buffer[read_pos];
 			read_pos = (read_pos + 1) % max_size;
 			--count;
-			cout << "Consumer " << id << " consumed " << value << endl;
+			metrics::gauge(depth, count);
+			metrics::add(consumed);
+			if (verbose) cout << "Consumer " << id << " consumed " << value << endl;
 			lock.unlock();
 			not_full.notify_one();
 			this_thread::sleep_for(milliseconds(150));
@@ -99,25 +286,35 @@ void producer_consumer_cv() {
 	consumer_thread.join();
 }
 
-void producer_consumer_atomic() {
+void producer_consumer_atomic(bool verbose) {
 	const int max_size = 5;
 	vector<int> buffer(max_size);
 	mutex mtx;
 	atomic<bool> data_ready{ false };
 	atomic<bool> done{ false };
 	int write_pos = 0, read_pos = 0;
+	const metrics::LockMetrics lock_metrics("pc_atomic.lock");
+	const metrics::Metric handoff = metrics::histogram("pc_atomic.handoff_wait_ns");
+	const metrics::Metric empty_polls = metrics::counter("pc_atomic.empty_polls");
+	const metrics::Metric produced = metrics::counter("pc_atomic.produced");
+	const metrics::Metric consumed = metrics::counter("pc_atomic.consumed");
 
 	auto producer = [&](int id) {
 		for (int i = 0; i < 10; ++i) {
-			unique_lock<mutex> lock(mtx);
+			metrics::TimedLock<mutex> lock(mtx, lock_metrics);
 			buffer[write_pos] = i;
 			write_pos = (write_pos + 1) % max_size;
 			data_ready = true;
-			cout << "Producer " << id << " produced " << i << endl;
+			metrics::add(produced);
+			if (verbose) cout << "Producer " << id << " produced " << i << endl;
 			lock.unlock();
 
-			while (data_ready && !done) {
-				this_thread::yield();
+			{
+				// Spinning until the consumer takes the value.
+				metrics::Span span(handoff);
+				while (data_ready && !done) {
+					this_thread::yield();
+				}
 			}
 			this_thread::sleep_for(milliseconds(100));
 		}
@@ -126,13 +323,17 @@ void producer_consumer_atomic() {
 	auto consumer = [&](int id) {
 		while (!done || data_ready) {
 			if (data_ready) {
-				unique_lock<mutex> lock(mtx);
+				metrics::TimedLock<mutex> lock(mtx, lock_metrics);
 				int value = buffer[read_pos];
 				read_pos = (read_pos + 1) % max_size;
 				data_ready = false;
-				cout << "Consumer " << id << " consumed " << value << endl;
+				metrics::add(consumed);
+				if (verbose) cout << "Consumer " << id << " consumed " << value << endl;
 				lock.unlock();
 			}
+			else {
+				metrics::add(empty_polls);
+			}
 			this_thread::sleep_for(milliseconds(150));
 		}
 		};
@@ -147,6 +348,8 @@ void producer_consumer_atomic() {
 }
 
 
+// Starvation shows up as overtaking: rw.writer_overtaken counts readers let
+// in while a writer was waiting, rw.reader_overtaken the reverse.
 class ReaderWriter {
 private:
 	mutable mutex mtx;
@@ -154,38 +357,61 @@ private:
 	atomic<int> readers{ 0 };
 	atomic<bool> writer_active{ false };
 	atomic<bool> done{ false }; 
+	int waiting_readers = 0, waiting_writers = 0;
+	bool verbose;
+	const metrics::LockMetrics lock_metrics{ "rw.lock" };
+	const metrics::Metric read_wait = metrics::histogram("rw.read_wait_ns");
+	const metrics::Metric write_wait = metrics::histogram("rw.write_wait_ns");
+	const metrics::Metric reading = metrics::histogram("rw.read_ns");
+	const metrics::Metric writing = metrics::histogram("rw.write_ns");
+	const metrics::Metric writer_overtaken = metrics::counter("rw.writer_overtaken");
+	const metrics::Metric reader_overtaken = metrics::counter("rw.reader_overtaken");
 
 public:
+	explicit ReaderWriter(bool print_events = true) : verbose(print_events) {}
+
 	void read() {
-		unique_lock<mutex> lock(mtx);
-		no_writer.wait(lock, [this] {
+		metrics::TimedLock<mutex> lock(mtx, lock_metrics);
+		++waiting_readers;
+		lock.wait(no_writer, [this] {
 			return !writer_active.load() || done.load();
-			});
+			}, read_wait);
+		--waiting_readers;
 
 		if (done) return;
 
 		++readers;
+		if (waiting_writers > 0) metrics::add(writer_overtaken);
 		lock.unlock();
 
-		cout << "Reader " << this_thread::get_id() << " is reading" << endl;
-		this_thread::sleep_for(milliseconds(50));
+		{
+			metrics::Span span(reading);
+			if (verbose) cout << "Reader " << this_thread::get_id() << " is reading" << endl;
+			this_thread::sleep_for(milliseconds(50));
+		}
 
 		--readers;
 	}
 
 	void write() {
-		unique_lock<mutex> lock(mtx);
-		no_writer.wait(lock, [this] {
+		metrics::TimedLock<mutex> lock(mtx, lock_metrics);
+		++waiting_writers;
+		lock.wait(no_writer, [this] {
 			return (!writer_active.load() && readers.load() == 0) || done.load();
-			});
+			}, write_wait);
+		--waiting_writers;
 
 		if (done) return;
 
 		writer_active = true;
+		if (waiting_readers > 0) metrics::add(reader_overtaken);
 		lock.unlock();
 
-		cout << "Writer " << this_thread::get_id() << " is writing" << endl;
-		this_thread::sleep_for(milliseconds(100));
+		{
+			metrics::Span span(writing);
+			if (verbose) cout << "Writer " << this_thread::get_id() << " is writing" << endl;
+			this_thread::sleep_for(milliseconds(100));
+		}
 
 		writer_active = false;
 		no_writer.notify_all();
@@ -197,8 +423,8 @@ public:
 	}
 };
 
-void reader_writer() {
-	ReaderWriter rw;
+void reader_writer(bool verbose) {
+	ReaderWriter rw(verbose);
 	vector<thread> readers;
 	vector<thread> writers;
 
@@ -226,32 +452,186 @@ void reader_writer() {
 	for (auto& t : writers) t.join();
 }
 
-int main() {
+// Producers push items_per_producer values each while as many consumers pop
+// them, all through one queue whose storage comes from resource.
+void queue_workload(pmr::memory_resource* resource, int producers, int items_per_producer) {
+	ThreadSafeQueue<long long> q("bench_queue", resource);
+	vector<thread> threads;
+
+	for (int p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p] {
+			for (int i = 0; i < items_per_producer; ++i) q.push((long long)p * items_per_producer + i);
+			});
+		threads.emplace_back([&] {
+			long long value, sum = 0;
+			for (int i = 0; i < items_per_producer; ++i) {
+				q.wait_and_pop(value);
+				sum += value;
+			}
+			volatile long long sink = sum;
+			(void)sink;
+			});
+	}
+	for (auto& t : threads) t.join();
+}
+
+void queue_allocators(bench::Suite& suite) {
+	const int items_per_producer = (int)suite.options().get_int("queue-items", 200000);
+	const int max_producers = max(1, (int)thread::hardware_concurrency() / 2);
+	pc::PoolResource pool;
+
+	for (int producers = 1; producers <= max_producers; producers *= 2) {
+		const string params = bench::params({ { "producers", producers }, { "items", items_per_producer } });
+		const bench::Throughput items = bench::items((double)producers * items_per_producer);
+		bench::Result heap = suite.run("queue_heap", params, items, [&] { queue_workload(pmr::get_default_resource(), producers, items_per_producer); });
+		bench::Result pooled = suite.run("queue_pool", params, items, [&] { queue_workload(&pool, producers, items_per_producer); });
+		cout << "Pool vs heap: " << heap.ms.median / pooled.ms.median << "x" << endl;
+	}
+
+	// Consumers free every queue chunk the producers allocated. Repeating the
+	// run on one pool must reuse those chunks: upstream usage may grow while
+	// the shards warm up, but not with the number of items pushed.
+	pc::PoolResource reused;
+	const int warm_rounds = 2, rounds = 8;
+	size_t warm_bytes = 0;
+	for (int round = 1; round <= rounds; ++round) {
+		queue_workload(&reused, max_producers, items_per_producer);
+		if (round == warm_rounds) warm_bytes = reused.upstream_bytes();
+	}
+	const size_t final_bytes = reused.upstream_bytes();
+	const long long items = (long long)max_producers * items_per_producer;
+	cout << "Pool upstream: " << warm_bytes / 1048576.0 << " MB after " << warm_rounds * items << " items, "
+		<< final_bytes / 1048576.0 << " MB after " << rounds * items << " items: "
+		<< (final_bytes <= 2 * warm_bytes ? "bounded" : "GROWING") << endl;
+}
+
+// thread_count threads run ops_per_thread random finds, inserts and erases
+// each against one map that starts half full. The map is filled once per
+// case, so every trial starts from the state the previous one left.
+template<typename Map>
+bench::Result map_benchmark(bench::Suite& suite, const string& name, int thread_count, int read_percent, int key_range, int ops_per_thread) {
+	Map map;
+	for (int k = 0; k < key_range; k += 2) map.insert_or_assign(k, k);
+
+	auto worker = [&](int id) {
+		mt19937 gen(id + 1);
+		uniform_int_distribution<> key_dis(0, key_range - 1);
+		uniform_int_distribution<> op_dis(0, 99);
+		int value = 0;
+		long long hits = 0;
+
+		for (int i = 0; i < ops_per_thread; ++i) {
+			int key = key_dis(gen);
+			int op = op_dis(gen);
+			if (op < read_percent) {
+				hits += map.find(key, value);
+			}
+			else if ((op & 1) == 0) {
+				map.insert_or_assign(key, i);
+			}
+			else {
+				map.erase(key);
+			}
+		}
+		volatile long long sink = hits;
+		(void)sink;
+		};
+
+	const string params = bench::params({ { "threads", thread_count }, { "read_percent", read_percent }, { "keys", key_range } });
+	return suite.run(name, params, bench::items((double)thread_count * ops_per_thread), [&] {
+		vector<thread> threads;
+		for (int t = 0; t < thread_count; ++t) threads.emplace_back(worker, t);
+		for (auto& t : threads) t.join();
+		});
+}
+
+void concurrent_map(bench::Suite& suite) {
+	const int key_range = (int)suite.options().get_int("map-keys", 1 << 16);
+	const int ops_per_thread = (int)suite.options().get_int("map-ops", 200000);
+	const int max_threads = max(1, (int)thread::hardware_concurrency());
+
+	for (long long read_percent : suite.options().get_list("read-percent", { 50, 90, 99 })) {
+		for (int threads = 1; threads <= max_threads; threads *= 2) {
+			bench::Result striped = map_benchmark<ConcurrentHashMap<int, int>>(suite, "map_striped", threads, (int)read_percent, key_range, ops_per_thread);
+			bench::Result locked = map_benchmark<LockedHashMap<int, int>>(suite, "map_locked", threads, (int)read_percent, key_range, ops_per_thread);
+			cout << "Striped vs locked: " << locked.ms.median / striped.ms.median << "x" << endl;
+		}
+	}
+}
+
+// Command line (all optional, plus the bench::Suite options):
+//   --verbose               print every queue, producer and reader/writer event
+//   --trace FILE            write a Chrome trace of lock holds and queue depths
+//   --trace-events N        trace buffer per thread (default 100000)
+//   --metrics-interval MS   print the metrics of each interval while running
+//   --queue-items N         items per producer in the queue storage cases (default 200000)
+//   --map-keys N            hash map key range (default 65536)
+//   --map-ops N             hash map operations per thread (default 200000)
+//   --read-percent A,B      hash map read shares to sweep (default 50,90,99)
+int main(int argc, char** argv) {
+	bench::Suite suite("ParaComp3", argc, argv);
+	const bench::Options& options = suite.options();
+	const bool verbose = options.has("verbose");
+	const string trace_path = options.get_string("trace");
+	if (!trace_path.empty()) metrics::enable_trace((size_t)options.get_int("trace-events", 100000));
+	const long long interval = options.get_int("metrics-interval", 0);
+	unique_ptr<metrics::Sampler> sampler;
+	if (interval > 0) sampler.reset(new metrics::Sampler(milliseconds(interval), cout));
+
+	metrics::Snapshot section = metrics::snapshot();
+	auto print_section = [&](const string& prefix) {
+		metrics::Snapshot now = metrics::snapshot();
+		now.since(section).print(cout, prefix);
+		section = now;
+	};
+
 	cout << "=== Thread-safe Queue Test ===" << endl;
 	ThreadSafeQueue<int> tsq;
 	thread t1([&]() { 
-		for (int i = 0; i < 5; ++i) {
-			tsq.push(i);
-			cout << "Pushed: " << i << endl;
+		{
+			perf::Region region("queue_push");
+			for (int i = 0; i < 5; ++i) tsq.push(i);
 		}
+		if (verbose) for (int i = 0; i < 5; ++i) cout << "Pushed: " << i << endl;
 	});
 	thread t2([&]() {
-		int val;
-		for (int i = 0; i < 5; ++i) {
-			tsq.wait_and_pop(val);
-			cout << "Popped: " << val << endl;
+		int popped[5];
+		{
+			perf::Region region("queue_pop");
+			for (int i = 0; i < 5; ++i) tsq.wait_and_pop(popped[i]);
 		}
+		if (verbose) for (int i = 0; i < 5; ++i) cout << "Popped: " << popped[i] << endl;
 		});
 	t1.join(); t2.join();
+	print_section("queue.");
 
 	cout << "\n=== Producer-Consumer (conditional vars) ===" << endl;
-	producer_consumer_cv();
+	producer_consumer_cv(verbose);
+	print_section("pc_cv.");
 
 	cout << "\n=== Producer-Consumer (atomic) ===" << endl;
-	producer_consumer_atomic();
+	producer_consumer_atomic(verbose);
+	print_section("pc_atomic.");
 
 	cout << "\n=== Reader-Writer ===" << endl;
-	reader_writer();
+	reader_writer(verbose);
+	print_section("rw.");
+
+	cout << "\n=== Queue Storage: Heap vs Pool ===" << endl;
+	queue_allocators(suite);
+	print_section("bench_queue.");
+
+	cout << "\n=== Concurrent Hash Map ===" << endl;
+	concurrent_map(suite);
+
+	sampler.reset();
+	cout << "\n=== Synchronization metrics ===" << endl;
+	metrics::snapshot().print(cout);
+	if (!trace_path.empty()) {
+		if (metrics::write_trace(trace_path)) cout << "Trace written to " << trace_path << endl;
+		else cerr << "Cannot write trace " << trace_path << endl;
+	}
 
-	return 0;
+	perf::report();
+	return suite.report();
 }
\ No newline at end of file
@@ -3,8 +3,21 @@
 #include <cmath>
 #include <chrono>
 #include <algorithm>
-#include <random>
+#include <functional>
+#include <numeric>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <immintrin.h>
 #include <omp.h>
+#include "../../Common/autotune.h"
+#include "../../Common/benchmark.h"
+#include "../../Common/factorize.h"
+#include "../../Common/matrix_file.h"
+#include "../../Common/perf_counters.h"
+#include "../../Common/philox.h"
+#include "../../Common/policy.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -34,26 +47,377 @@ double pi_parallel(int n) {
 	return h * sum;
 }
 
-void pi() {
-	const int n = 10000000;
-	const double exact_pi = 3.141592653589793;
+inline int in_quarter_circle(uint32_t wx, uint32_t wy) {
+	float x = rng::unit_float(wx), y = rng::unit_float(wy);
+	return x * x + y * y < 1.0f ? 1 : 0;
+}
+
+// Monte Carlo estimate: the share of random points of the unit square that
+// land inside the quarter circle. Point i is half i % 2 of Philox block i / 2,
+// so the estimate is the same for any number of threads.
+double pi_monte_carlo(long long samples, uint64_t seed) {
+	const rng::Philox4x32 gen(seed);
+	const int batches = (int)(samples / 8);
+	long long inside = 0;
+
+#pragma omp parallel for reduction(+:inside)
+	for (int batch = 0; batch < batches; ++batch) {
+		rng::Block b[4];
+		gen.blocks4((uint64_t)batch * 4, b);
+		for (int l = 0; l < 4; ++l) {
+			inside += in_quarter_circle(b[l].v[0], b[l].v[1]) + in_quarter_circle(b[l].v[2], b[l].v[3]);
+		}
+	}
+
+	for (long long i = (long long)batches * 8; i < samples; ++i) {
+		rng::Block b = gen.block((uint64_t)i / 2);
+		int half = (int)(i % 2) * 2;
+		inside += in_quarter_circle(b.v[half], b.v[half + 1]);
+	}
+
+	return 4.0 * inside / samples;
+}
 
-	auto start = high_resolution_clock::now();
-	double seq_pi = pi_sequential(n);
-	auto end = high_resolution_clock::now();
-	auto seq_time = duration_cast<milliseconds>(end - start).count();
+// 4 / (1 + x^2), whose integral over [0, 1] is pi. The __m128d overload
+// lets the simd integration evaluate two points at once.
+struct pi_integrand {
+	double operator()(double x) const { return 4.0 / (1.0 + x * x); }
+	__m128d operator()(__m128d x) const { return _mm_div_pd(_mm_set1_pd(4.0), _mm_add_pd(_mm_set1_pd(1.0), _mm_mul_pd(x, x))); }
+};
+
+double pi_tuned(const tune::Config& config, long long n) {
+	return pc::integrate(pc::openmp(pc::simd, (int)config.get("threads", 0)), pc::rectangle, pi_integrand(), 0.0, 1.0, n);
+}
+
+// OpenMP thread count for the integration, per bucket of n: a short
+// integral does not pay for waking every core.
+tune::Config tune_pi(tune::Tuner& tuner, long long n) {
+	const vector<tune::Param> space = { { "threads", tune::thread_candidates() } };
+	return tuner.tune("ParaComp4.integrate", n, space, [&](const tune::Config& config) {
+		return tune::time_min_ms([&] { pi_tuned(config, n); });
+		});
+}
 
-	start = high_resolution_clock::now();
-	double par_pi = pi_parallel(n);
-	end = high_resolution_clock::now();
-	auto par_time = duration_cast<milliseconds>(end - start).count();
+void pi(bench::Suite& suite, tune::Tuner& tuner) {
+	const double exact_pi = 3.141592653589793;
 
 	cout << "=== Pi calculation ===" << endl;
-	cout << "Referencr value: " << exact_pi << endl;
-	cout << "Sequential value: " << seq_pi << " (err: " << abs(seq_pi - exact_pi) << ")" << endl;
-	cout << "Sequential time: " << seq_time << " ms" << endl;
-	cout << "Parallel value: " << par_pi << " (err: " << abs(par_pi - exact_pi) << ")" << endl;
-	cout << "Parallel value: " << par_time << " ms" << endl;
+	for (long long n : suite.options().get_list("n", { 10000000 })) {
+		const string params = bench::params({ { "n", n } });
+		double seq_pi = 0.0, par_pi = 0.0;
+
+		suite.run("pi_sequential", params, bench::evals(n), [&] { seq_pi = pi_sequential((int)n); });
+		suite.run("pi_parallel", params, bench::evals(n), [&] { par_pi = pi_parallel((int)n); });
+		double policy_pi = 0.0;
+		suite.run("pi_policy", params + " policy=openmp+simd", bench::evals(n), [&] {
+			policy_pi = pc::integrate(pc::openmp(pc::simd), pc::rectangle, pi_integrand(), 0.0, 1.0, n);
+			});
+		const tune::Config tuned = tune_pi(tuner, n);
+		double tuned_pi = 0.0;
+		suite.run("pi_tuned", params + " " + tuned.to_string(), bench::evals(n), [&] { tuned_pi = pi_tuned(tuned, n); });
+		double mc_pi = 0.0;
+		suite.run("pi_monte_carlo", params, bench::evals(n), [&] { mc_pi = pi_monte_carlo(n, 2024); });
+
+		cout << "Referencr value: " << exact_pi << endl;
+		cout << "Sequential value: " << seq_pi << " (err: " << abs(seq_pi - exact_pi) << ")" << endl;
+		cout << "Parallel value: " << par_pi << " (err: " << abs(par_pi - exact_pi) << ")" << endl;
+		cout << "Policy value: " << policy_pi << " (err: " << abs(policy_pi - exact_pi) << ")" << endl;
+		cout << "Tuned value: " << tuned_pi << " (err: " << abs(tuned_pi - exact_pi) << ")" << endl;
+		cout << "Monte Carlo value: " << mc_pi << " (err: " << abs(mc_pi - exact_pi) << ")" << endl;
+	}
+}
+
+// Parallel primitives. Every one of them splits the input into one
+// contiguous block per thread; blocks are combined in thread order, so the
+// operators only need to be associative, not commutative.
+inline void thread_block(int n, int t, int nt, int& begin, int& end) {
+	begin = (int)((long long)n * t / nt);
+	end = (int)((long long)n * (t + 1) / nt);
+}
+
+struct max_of {
+	template<typename T>
+	T operator()(T a, T b) const { return a > b ? a : b; }
+};
+
+// Operators whose operands may be regrouped in any order. Only these get
+// the multi-accumulator reduction; everything else is folded in order.
+template<typename Op, typename T>
+struct is_commutative : false_type {};
+
+template<typename T>
+struct is_commutative<plus<T>, T> : is_arithmetic<T> {};
+
+template<typename T>
+struct is_commutative<multiplies<T>, T> : is_arithmetic<T> {};
+
+template<typename T>
+struct is_commutative<max_of, T> : is_arithmetic<T> {};
+
+template<typename T, typename Op>
+T reduce_block(const T* data, int begin, int end, T identity, Op op, false_type) {
+	T acc = identity;
+	for (int i = begin; i < end; ++i) acc = op(acc, data[i]);
+	return acc;
+}
+
+// Four independent accumulators break the loop-carried dependency so the
+// compiler can keep them in one SIMD register. They interleave the block,
+// so the operator must be commutative.
+template<typename T, typename Op>
+T reduce_block(const T* data, int begin, int end, T identity, Op op, true_type) {
+	T acc0 = identity, acc1 = identity, acc2 = identity, acc3 = identity;
+	int i = begin;
+	for (; i + 4 <= end; i += 4) {
+		acc0 = op(acc0, data[i]);
+		acc1 = op(acc1, data[i + 1]);
+		acc2 = op(acc2, data[i + 2]);
+		acc3 = op(acc3, data[i + 3]);
+	}
+	for (; i < end; ++i) acc0 = op(acc0, data[i]);
+	return op(op(acc0, acc1), op(acc2, acc3));
+}
+
+template<typename T, typename Op>
+T reduce_block(const T* data, int begin, int end, T identity, Op op) {
+	return reduce_block(data, begin, end, identity, op, is_commutative<Op, T>());
+}
+
+template<typename T, typename Op>
+T reduce_parallel(const vector<T>& in, T identity, Op op) {
+	const int n = (int)in.size();
+	vector<T> partial(omp_get_max_threads(), identity);
+	int used_threads = 1;
+
+#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		int begin, end;
+		thread_block(n, t, nt, begin, end);
+		partial[t] = reduce_block(in.data(), begin, end, identity, op);
+		if (t == 0) used_threads = nt;
+	}
+
+	T result = identity;
+	for (int t = 0; t < used_threads; ++t) result = op(result, partial[t]);
+	return result;
+}
+
+template<typename T, typename Op>
+T scan_block(const T* in, T* out, int begin, int end, T carry, Op op) {
+	for (int i = begin; i < end; ++i) {
+		carry = op(carry, in[i]);
+		out[i] = carry;
+	}
+	return carry;
+}
+
+// In-register prefix sum of four ints: two shift-and-add steps.
+inline int scan_block(const int* in, int* out, int begin, int end, int carry, plus<int>) {
+	__m128i offset = _mm_set1_epi32(carry);
+	int i = begin;
+	for (; i + 4 <= end; i += 4) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi32(x, offset);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), x);
+		offset = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	carry = _mm_cvtsi128_si32(offset);
+	for (; i < end; ++i) {
+		carry += in[i];
+		out[i] = carry;
+	}
+	return carry;
+}
+
+// Two-pass blocked scan: every thread reduces its block, the block totals
+// are scanned serially, then every thread rescans its block from its offset.
+template<typename T, typename Op>
+void scan_parallel(const vector<T>& in, vector<T>& out, T identity, Op op, bool inclusive) {
+	const int n = (int)in.size();
+	out.resize(n);
+	vector<T> offsets(omp_get_max_threads() + 1, identity);
+
+#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		int begin, end;
+		thread_block(n, t, nt, begin, end);
+
+		offsets[t + 1] = reduce_block(in.data(), begin, end, identity, op);
+#pragma omp barrier
+#pragma omp single
+		{
+			for (int i = 1; i <= nt; ++i) offsets[i] = op(offsets[i - 1], offsets[i]);
+		}
+
+		if (inclusive) {
+			scan_block(in.data(), out.data(), begin, end, offsets[t], op);
+		}
+		else {
+			T carry = offsets[t];
+			for (int i = begin; i < end; ++i) {
+				T value = in[i];
+				out[i] = carry;
+				carry = op(carry, value);
+			}
+		}
+	}
+}
+
+template<typename T, typename Op = plus<T>>
+void inclusive_scan_parallel(const vector<T>& in, vector<T>& out, Op op = Op(), T identity = T()) {
+	scan_parallel(in, out, identity, op, true);
+}
+
+template<typename T, typename Op = plus<T>>
+void exclusive_scan_parallel(const vector<T>& in, vector<T>& out, Op op = Op(), T identity = T()) {
+	scan_parallel(in, out, identity, op, false);
+}
+
+// Histogram with per-thread private bins merged bin-parallel at the end.
+template<typename T, typename BinOf>
+vector<long long> histogram_parallel(const vector<T>& in, int bins, BinOf bin_of) {
+	const int n = (int)in.size();
+	vector<long long> local(omp_get_max_threads() * bins, 0);
+	vector<long long> result(bins, 0);
+	int used_threads = 1;
+
+#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		int begin, end;
+		thread_block(n, t, nt, begin, end);
+		long long* my_bins = &local[t * bins];
+		for (int i = begin; i < end; ++i) {
+			++my_bins[bin_of(in[i])];
+		}
+		if (t == 0) used_threads = nt;
+#pragma omp barrier
+#pragma omp for
+		for (int b = 0; b < bins; ++b) {
+			long long sum = 0;
+			for (int tt = 0; tt < used_threads; ++tt) sum += local[tt * bins + b];
+			result[b] = sum;
+		}
+	}
+
+	return result;
+}
+
+// Stream compaction: count survivors per block, scan the counts, copy.
+template<typename T, typename Pred>
+vector<T> compact_parallel(const vector<T>& in, Pred pred) {
+	const int n = (int)in.size();
+	vector<int> offsets(omp_get_max_threads() + 1, 0);
+	vector<T> out;
+
+#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		int begin, end;
+		thread_block(n, t, nt, begin, end);
+
+		int count = 0;
+		for (int i = begin; i < end; ++i) count += pred(in[i]) ? 1 : 0;
+		offsets[t + 1] = count;
+#pragma omp barrier
+#pragma omp single
+		{
+			for (int i = 1; i <= nt; ++i) offsets[i] += offsets[i - 1];
+			out.resize(offsets[nt]);
+		}
+
+		int pos = offsets[t];
+		for (int i = begin; i < end; ++i) {
+			if (pred(in[i])) out[pos++] = in[i];
+		}
+	}
+
+	return out;
+}
+
+// Uniform ints in [lo, hi]; element i depends only on seed and i, so the
+// contents do not change with the thread count.
+void random_fill(vector<int>& out, uint64_t seed, int lo, int hi) {
+	const rng::Philox4x32 gen(seed);
+	const int n = (int)out.size();
+
+#pragma omp parallel
+	{
+		int begin, end;
+		thread_block(n, omp_get_thread_num(), omp_get_num_threads(), begin, end);
+		rng::uniform_int(gen, begin, out.data() + begin, end - begin, lo, hi);
+	}
+}
+
+void primitives(bench::Suite& suite) {
+	const int bins = 64;
+
+	cout << "=== Parallel primitives ===" << endl;
+	for (long long size : suite.options().get_list("primitives-n", { 20000000 })) {
+		const int n = (int)size;
+		const string params = bench::params({ { "n", size } });
+		const double bytes = (double)n * sizeof(int);
+
+		vector<int> data(n);
+		random_fill(data, 42, 0, 99);
+
+		long long seq_sum = 0;
+		int par_sum = 0;
+		suite.run("reduce_sequential", params, bench::bytes(bytes), [&] {
+			seq_sum = 0;
+			for (int x : data) seq_sum += x;
+			});
+		suite.run("reduce_parallel", params, bench::bytes(bytes), [&] { par_sum = reduce_parallel(data, 0, plus<int>()); });
+		const int par_max = reduce_parallel(data, INT_MIN, max_of());
+		const int seq_max = n > 0 ? *max_element(data.begin(), data.end()) : INT_MIN;
+
+		vector<int> seq_scan(n), par_scan(n), par_exscan(n);
+		suite.run("scan_sequential", params, bench::bytes(2 * bytes), [&] { partial_sum(data.begin(), data.end(), seq_scan.begin()); });
+		suite.run("scan_parallel", params, bench::bytes(2 * bytes), [&] { inclusive_scan_parallel(data, par_scan); });
+		exclusive_scan_parallel(data, par_exscan);
+
+		bool exscan_ok = n == 0 || par_exscan[0] == 0;
+		for (int i = 1; i < n && exscan_ok; ++i) exscan_ok = par_exscan[i] == seq_scan[i - 1];
+
+		vector<long long> hist;
+		suite.run("histogram_parallel", params, bench::bytes(bytes), [&] {
+			hist = histogram_parallel(data, bins, [&](int x) { return x * bins / 100; });
+			});
+
+		long long hist_total = 0;
+		for (long long c : hist) hist_total += c;
+
+		vector<int> small;
+		suite.run("compact_parallel", params, bench::bytes(bytes), [&] {
+			small = compact_parallel(data, [](int x) { return x < 10; });
+			});
+
+		// String concatenation is associative but not commutative, so any
+		// reordering inside or across blocks shows up in the result.
+		vector<string> letters(min(n, 1000));
+		for (size_t i = 0; i < letters.size(); ++i) letters[i] = string(1, char('a' + i % 26));
+		vector<string> seq_concat(letters.size()), par_concat, par_exconcat;
+		partial_sum(letters.begin(), letters.end(), seq_concat.begin());
+		inclusive_scan_parallel(letters, par_concat);
+		exclusive_scan_parallel(letters, par_exconcat);
+		bool concat_ok = reduce_parallel(letters, string(), plus<string>()) == accumulate(letters.begin(), letters.end(), string())
+			&& par_concat == seq_concat;
+		for (size_t i = 0; i < letters.size() && concat_ok; ++i) concat_ok = par_exconcat[i] == (i > 0 ? seq_concat[i - 1] : string());
+
+		cout << "Reduce: " << (par_sum == seq_sum && par_max == seq_max ? "ok" : "MISMATCH") << endl;
+		cout << "Scan: " << (par_scan == seq_scan && exscan_ok ? "ok" : "MISMATCH") << endl;
+		cout << "Non-commutative reduce and scan: " << (concat_ok ? "ok" : "MISMATCH") << endl;
+		cout << "Histogram: " << (hist_total == n ? "ok" : "MISMATCH") << endl;
+		cout << "Compaction kept " << small.size() << endl;
+	}
 }
 
 void selection_sort_sequential(vector<int>& arr) {
@@ -68,71 +432,400 @@ void selection_sort_sequential(vector<int>& arr) {
 	}
 }
 
-void selection_sort_parallel(vector<int>& arr, int num_threads) {
-#pragma omp parallel for num_threads(num_threads)
-	for (auto i = 0; i < arr.size() - 1; ++i) {
-		size_t min_idx = i;
-		for (size_t j = i + 1; j < arr.size(); ++j) {
-			if (arr[j] < arr[min_idx]) {
-				min_idx = j;
+// Radix sort works on unsigned 32-bit codes whose unsigned order matches the
+// key order; decode() maps them back once the sort is done.
+template<typename K>
+struct RadixKey;
+
+template<>
+struct RadixKey<unsigned> {
+	static unsigned encode(unsigned k) { return k; }
+	static unsigned decode(unsigned c) { return c; }
+};
+
+template<>
+struct RadixKey<int> {
+	static unsigned encode(int k) { return static_cast<unsigned>(k) ^ 0x80000000u; }
+	static int decode(unsigned c) { return static_cast<int>(c ^ 0x80000000u); }
+};
+
+template<>
+struct RadixKey<float> {
+	static unsigned encode(float k) {
+		unsigned u;
+		memcpy(&u, &k, sizeof(u));
+		return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+	}
+	static float decode(unsigned c) {
+		unsigned u = (c & 0x80000000u) ? (c ^ 0x80000000u) : ~c;
+		float k;
+		memcpy(&k, &u, sizeof(k));
+		return k;
+	}
+};
+
+// Parallel LSD radix sort, 8 bits per pass. Every thread histograms its own
+// block, one thread turns the (digit, thread) histograms into scatter offsets,
+// then every thread scatters its block. The sort is stable, so the optional
+// payload array moves together with the codes.
+template<typename V>
+void radix_sort_codes(vector<unsigned>& codes, vector<V>* values) {
+	const int radix = 256;
+	const int n = (int)codes.size();
+	vector<unsigned> codes_tmp(n);
+	vector<V> values_tmp(values ? n : 0);
+	vector<int> hist(omp_get_max_threads() * radix);
+
+#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		int begin = (int)((long long)n * t / nt);
+		int end = (int)((long long)n * (t + 1) / nt);
+		int* my_hist = &hist[t * radix];
+
+		unsigned* src = codes.data();
+		unsigned* dst = codes_tmp.data();
+		V* vsrc = values ? values->data() : nullptr;
+		V* vdst = values ? values_tmp.data() : nullptr;
+
+		for (int shift = 0; shift < 32; shift += 8) {
+			fill(my_hist, my_hist + radix, 0);
+			for (int i = begin; i < end; ++i) {
+				++my_hist[(src[i] >> shift) & 0xFF];
+			}
+#pragma omp barrier
+#pragma omp single
+			{
+				int offset = 0;
+				for (int d = 0; d < radix; ++d) {
+					for (int tt = 0; tt < nt; ++tt) {
+						int count = hist[tt * radix + d];
+						hist[tt * radix + d] = offset;
+						offset += count;
+					}
+				}
+			}
+			for (int i = begin; i < end; ++i) {
+				int pos = my_hist[(src[i] >> shift) & 0xFF]++;
+				dst[pos] = src[i];
+				if (vsrc) vdst[pos] = vsrc[i];
 			}
+#pragma omp barrier
+			swap(src, dst);
+			swap(vsrc, vdst);
 		}
-#pragma omp critical
-		swap(arr[i], arr[min_idx]);
 	}
 }
 
-void sort() {
-	const size_t size = 10000;
-	vector<int> arr_seq(size);
-	vector<int> arr_par(size);
+template<typename K>
+void radix_sort_parallel(vector<K>& keys) {
+	const int n = (int)keys.size();
+	vector<unsigned> codes(n);
+
+#pragma omp parallel for
+	for (int i = 0; i < n; ++i) codes[i] = RadixKey<K>::encode(keys[i]);
+
+	radix_sort_codes<char>(codes, nullptr);
+
+#pragma omp parallel for
+	for (int i = 0; i < n; ++i) keys[i] = RadixKey<K>::decode(codes[i]);
+}
 
-	random_device rd;
-	mt19937 gen(rd());
-	uniform_int_distribution<> dis(1, 100000);
+template<typename K, typename V>
+void radix_sort_pairs_parallel(vector<K>& keys, vector<V>& values) {
+	const int n = (int)keys.size();
+	vector<unsigned> codes(n);
 
-	for (size_t i = 0; i < size; ++i) {
-		arr_seq[i] = arr_par[i] = dis(gen);
+#pragma omp parallel for
+	for (int i = 0; i < n; ++i) codes[i] = RadixKey<K>::encode(keys[i]);
+
+	radix_sort_codes(codes, &values);
+
+#pragma omp parallel for
+	for (int i = 0; i < n; ++i) keys[i] = RadixKey<K>::decode(codes[i]);
+}
+
+template<typename K>
+vector<int> argsort_parallel(const vector<K>& keys) {
+	const int n = (int)keys.size();
+	vector<K> sorted_keys(keys);
+	vector<int> index(n);
+
+#pragma omp parallel for
+	for (int i = 0; i < n; ++i) index[i] = i;
+
+	radix_sort_pairs_parallel(sorted_keys, index);
+	return index;
+}
+
+// In-register bitonic sorting network for 16 ints, SSE2 only.
+static inline __m128i min_epi32(__m128i a, __m128i b) {
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+static inline __m128i max_epi32(__m128i a, __m128i b) {
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+static inline void compare_swap(__m128i& a, __m128i& b) {
+	__m128i lo = min_epi32(a, b);
+	b = max_epi32(a, b);
+	a = lo;
+}
+
+static inline __m128i reverse_epi32(__m128i v) {
+	return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+// Sorts a bitonic 4-vector (half-cleaners at distance 2 and 1).
+static inline __m128i bitonic_clean4(__m128i v) {
+	__m128i t = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+	v = _mm_unpacklo_epi64(min_epi32(v, t), max_epi32(v, t));
+
+	t = _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128i mn = min_epi32(v, t);
+	__m128i mx = max_epi32(v, t);
+	return _mm_unpacklo_epi64(_mm_unpacklo_epi32(mn, mx), _mm_unpackhi_epi32(mn, mx));
+}
+
+static inline void bitonic_merge4(__m128i& a, __m128i& b) {
+	b = reverse_epi32(b);
+	compare_swap(a, b);
+	a = bitonic_clean4(a);
+	b = bitonic_clean4(b);
+}
+
+static inline void bitonic_merge8(__m128i& a0, __m128i& a1, __m128i& b0, __m128i& b1) {
+	__m128i rb0 = reverse_epi32(b1);
+	__m128i rb1 = reverse_epi32(b0);
+	compare_swap(a0, rb0);
+	compare_swap(a1, rb1);
+	compare_swap(a0, a1);
+	compare_swap(rb0, rb1);
+	a0 = bitonic_clean4(a0);
+	a1 = bitonic_clean4(a1);
+	b0 = bitonic_clean4(rb0);
+	b1 = bitonic_clean4(rb1);
+}
+
+void sort16_simd(int* p) {
+	__m128i r0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p));
+	__m128i r1 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + 4));
+	__m128i r2 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + 8));
+	__m128i r3 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + 12));
+
+	compare_swap(r0, r1);
+	compare_swap(r2, r3);
+	compare_swap(r0, r2);
+	compare_swap(r1, r3);
+	compare_swap(r1, r2);
+
+	__m128 f0 = _mm_castsi128_ps(r0), f1 = _mm_castsi128_ps(r1);
+	__m128 f2 = _mm_castsi128_ps(r2), f3 = _mm_castsi128_ps(r3);
+	_MM_TRANSPOSE4_PS(f0, f1, f2, f3);
+	r0 = _mm_castps_si128(f0); r1 = _mm_castps_si128(f1);
+	r2 = _mm_castps_si128(f2); r3 = _mm_castps_si128(f3);
+
+	bitonic_merge4(r0, r1);
+	bitonic_merge4(r2, r3);
+	bitonic_merge8(r0, r1, r2, r3);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(p), r0);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(p + 4), r1);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(p + 8), r2);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(p + 12), r3);
+}
+
+template<typename T, typename Compare>
+void sort_partition(T* first, T* last, Compare comp) {
+	sort(first, last, comp);
+}
+
+// ints: 16-element runs go through the network (the last one padded with
+// INT_MAX), then the runs are merged bottom-up, ping-ponging with a buffer.
+void sort_partition(int* first, int* last, less<int>) {
+	const ptrdiff_t n = last - first;
+	if (n < 2) return;
+	const ptrdiff_t full = n / 16 * 16;
+	for (ptrdiff_t i = 0; i < full; i += 16) sort16_simd(first + i);
+	if (full < n) {
+		int buf[16];
+		for (ptrdiff_t i = 0; i < 16; ++i) buf[i] = full + i < n ? first[full + i] : INT_MAX;
+		sort16_simd(buf);
+		copy(buf, buf + (n - full), first + full);
 	}
+	if (n <= 16) return;
 
-	auto start = high_resolution_clock::now();
-	selection_sort_sequential(arr_seq);
-	auto end = high_resolution_clock::now();
-	auto seq_time = duration_cast<milliseconds>(end - start).count();
+	vector<int> buffer(n);
+	int* from = first;
+	int* to = buffer.data();
+	for (ptrdiff_t width = 16; width < n; width *= 2) {
+		for (ptrdiff_t lo = 0; lo < n; lo += 2 * width) {
+			const ptrdiff_t mid = min(lo + width, n), hi = min(lo + 2 * width, n);
+			merge(from + lo, from + mid, from + mid, from + hi, to + lo);
+		}
+		swap(from, to);
+	}
+	if (from != first) copy(from, from + n, first);
+}
 
-	start = high_resolution_clock::now();
-	selection_sort_parallel(arr_par, omp_get_num_procs());
-	end = high_resolution_clock::now();
-	auto par_time = duration_cast<milliseconds>(end - start).count();
+// Parallel samplesort for arbitrary comparators: regular samples pick one
+// splitter per thread, each thread classifies and counts its block, the
+// buckets are scattered by prefix offsets and then sorted independently.
+template<typename T, typename Compare = less<T>>
+void sample_sort_parallel(vector<T>& arr, Compare comp = Compare()) {
+	const int n = (int)arr.size();
+	const int p = omp_get_max_threads() * 4;
+	const int oversample = 32;
+	if (n < p * oversample * 4) {
+		sort_partition(arr.data(), arr.data() + n, comp);
+		return;
+	}
+
+	vector<T> sample(p * oversample);
+	for (int i = 0; i < (int)sample.size(); ++i) {
+		sample[i] = arr[(long long)n * i / sample.size()];
+	}
+	sort(sample.begin(), sample.end(), comp);
+
+	vector<T> splitters(p - 1);
+	for (int i = 0; i < p - 1; ++i) splitters[i] = sample[(i + 1) * oversample];
+
+	vector<int> bucket_of(n);
+	vector<int> counts(p * p, 0);
+	vector<int> bucket_start(p + 1, 0);
+	vector<T> tmp(n);
+
+#pragma omp parallel for
+	for (int block = 0; block < p; ++block) {
+		int begin = (int)((long long)n * block / p);
+		int end = (int)((long long)n * (block + 1) / p);
+		int* my_counts = &counts[block * p];
+		for (int i = begin; i < end; ++i) {
+			int b = (int)(upper_bound(splitters.begin(), splitters.end(), arr[i], comp) - splitters.begin());
+			bucket_of[i] = b;
+			++my_counts[b];
+		}
+	}
+
+	int offset = 0;
+	for (int b = 0; b < p; ++b) {
+		bucket_start[b] = offset;
+		for (int block = 0; block < p; ++block) {
+			int count = counts[block * p + b];
+			counts[block * p + b] = offset;
+			offset += count;
+		}
+	}
+	bucket_start[p] = n;
+
+#pragma omp parallel for
+	for (int block = 0; block < p; ++block) {
+		int begin = (int)((long long)n * block / p);
+		int end = (int)((long long)n * (block + 1) / p);
+		int* my_offsets = &counts[block * p];
+		for (int i = begin; i < end; ++i) {
+			tmp[my_offsets[bucket_of[i]]++] = arr[i];
+		}
+	}
+
+#pragma omp parallel for schedule(dynamic)
+	for (int b = 0; b < p; ++b) {
+		sort_partition(tmp.data() + bucket_start[b], tmp.data() + bucket_start[b + 1], comp);
+	}
+
+	arr.swap(tmp);
+}
+
+void sort(bench::Suite& suite) {
+	const long long selection_sort_limit = 10000;
 
 	cout << "=== Array sort ===" << endl;
-	cout << "Size: " << size << endl;
-	cout << "Sequntial time: " << seq_time << " ms" << endl;
-	cout << "Parallel time: " << par_time << " ms" << endl;
+	for (long long size : suite.options().get_list("sort-n", { 10000, 1000000, 10000000 })) {
+		const string params = bench::params({ { "n", size } });
+		vector<int> source(size);
+		random_fill(source, (uint64_t)size, 1, 100000);
+
+		vector<int> arr_std, arr_radix, arr_sample, order;
+		if (size <= selection_sort_limit) {
+			vector<int> arr_seq;
+			suite.run("selection_sort_sequential", params, bench::items((double)size), [&] {
+				arr_seq = source;
+				selection_sort_sequential(arr_seq);
+				});
+		}
+		suite.run("std_sort", params, bench::items((double)size), [&] {
+			arr_std = source;
+			sort(arr_std.begin(), arr_std.end());
+			});
+		suite.run("radix_sort_parallel", params, bench::items((double)size), [&] {
+			arr_radix = source;
+			radix_sort_parallel(arr_radix);
+			});
+		suite.run("sample_sort_parallel", params, bench::items((double)size), [&] {
+			arr_sample = source;
+			sample_sort_parallel(arr_sample);
+			});
+		suite.run("argsort_parallel", params, bench::items((double)size), [&] { order = argsort_parallel(source); });
+
+		// The bucket sort on its own: independent partitions of --sort-partition.
+		const long long partition = suite.options().get_int("sort-partition", 256);
+		const string partition_params = bench::params({ { "n", size }, { "partition", partition } });
+		vector<int> arr_partition_std, arr_partition_network;
+		suite.run("partition_std_sort", partition_params, bench::items((double)size), [&] {
+			arr_partition_std = source;
+			for (long long i = 0; i < size; i += partition) {
+				sort(arr_partition_std.begin() + i, arr_partition_std.begin() + min(i + partition, size));
+			}
+			});
+		suite.run("partition_network", partition_params, bench::items((double)size), [&] {
+			arr_partition_network = source;
+			for (long long i = 0; i < size; i += partition) {
+				sort_partition(arr_partition_network.data() + i, arr_partition_network.data() + min(i + partition, size), less<int>());
+			}
+			});
+
+		bool argsort_ok = true;
+		for (long long i = 0; i < size; ++i) {
+			if (source[order[i]] != arr_std[i]) {
+				argsort_ok = false;
+				break;
+			}
+		}
+
+		cout << "Radix sort: " << (arr_radix == arr_std ? "ok" : "MISMATCH") << endl;
+		cout << "Sample sort: " << (arr_sample == arr_std ? "ok" : "MISMATCH") << endl;
+		cout << "Argsort: " << (argsort_ok ? "ok" : "MISMATCH") << endl;
+		cout << "Partition network: " << (arr_partition_network == arr_partition_std ? "ok" : "MISMATCH") << endl;
+	}
 }
 
+template<typename T>
 class Matrix {
 private:
-	vector<vector<double>> data;
+	vector<vector<T>> data;
 	int rows, cols;
 
 public:
-	Matrix(int r = 0, int c = 0) : rows(r), cols(c), data(r, vector<double>(c)) {}
+	Matrix(int r = 0, int c = 0) : rows(r), cols(c), data(r, vector<T>(c)) {}
 
-	void random_fill() {
-		random_device rd;
-		mt19937 gen(rd());
-		uniform_real_distribution<> dis(0.0, 10.0);
+	// Element (i, j) is number i * cols + j of the seed's sequence, so the
+	// rows can be filled in any order by any thread.
+	void random_fill(uint64_t seed) {
+		const rng::Philox4x32 gen(seed);
 
-		for (auto& row : data) {
-			for (auto& elem : row) {
-				elem = dis(gen);
-			}
+#pragma omp parallel for
+		for (int i = 0; i < rows; ++i) {
+			rng::uniform_real(gen, (uint64_t)i * cols, data[i].data(), cols, 0.0, 10.0);
 		}
 	}
 
 	Matrix multiply_sequential(const Matrix& other) const {
 		Matrix result(rows, other.cols);
+		perf::Region region("multiply_sequential", 2.0 * rows * cols * other.cols);
 
 		for (int i = 0; i < rows; ++i) {
 			for (int j = 0; j < other.cols; ++j) {
@@ -148,27 +841,85 @@ public:
 	Matrix multiply_parallel(const Matrix& other) const {
 		Matrix result(rows, other.cols);
 
-#pragma omp parallel for
-		for (int i = 0; i < rows; ++i) {
-			for (int j = 0; j < other.cols; ++j) {
-				double sum = 0.0;
-				for (int k = 0; k < cols; ++k) {
-					sum += data[i][k] * other.data[k][j];
-				}
+#pragma omp parallel
+		{
+			perf::Region region("multiply_parallel", 0.0, omp_get_thread_num());
+#pragma omp for
+			for (int i = 0; i < rows; ++i) {
+				for (int j = 0; j < other.cols; ++j) {
+					T sum = 0;
+					for (int k = 0; k < cols; ++k) {
+						sum += data[i][k] * other.data[k][j];
+					}
 #pragma omp critical
-				result.data[i][j] = sum;
+					result.data[i][j] = sum;
+				}
+				region.add_flops(2.0 * other.cols * cols);
 			}
 		}
 
 		return result;
 	}
 
+	// Same product as multiply_parallel with B transposed first, so the inner
+	// loop runs along two rows instead of down a column of B.
+	Matrix multiply_transposed(const Matrix& other) const {
+		const Matrix bt = other.transpose();
+		Matrix result(rows, other.cols);
+
+#pragma omp parallel
+		{
+			perf::Region region("multiply_transposed", 0.0, omp_get_thread_num());
+#pragma omp for
+			for (int i = 0; i < rows; ++i) {
+				for (int j = 0; j < other.cols; ++j) {
+					result.data[i][j] = pc::dot(pc::simd, data[i].data(), bt.data[j].data(), cols);
+				}
+				region.add_flops(2.0 * other.cols * cols);
+			}
+		}
+
+		return result;
+	}
+
+	Matrix transpose() const {
+		Matrix result(cols, rows);
+		pc::transpose(pc::openmp(pc::simd), *this, result);
+		return result;
+	}
+
+	// Square matrices are transposed in place, others through a copy.
+	void transpose_in_place() {
+		if (rows == cols) pc::transpose_in_place(pc::openmp(pc::simd), *this);
+		else *this = transpose();
+	}
+
+	// A * x.
+	vector<T> multiply_vector(const vector<T>& x) const {
+		vector<T> y(rows);
+		pc::gemv(pc::openmp(pc::simd), *this, x.data(), y.data());
+		return y;
+	}
+
+	// x^T * A.
+	vector<T> vector_multiply(const vector<T>& x) const {
+		vector<T> y(cols);
+		pc::gevm(pc::openmp(pc::simd), *this, x.data(), y.data());
+		return y;
+	}
+
+	int get_rows() const { return rows; }
+	int get_cols() const { return cols; }
+
+	T* row(int i) { return data[i].data(); }
+	const T* row(int i) const { return data[i].data(); }
+
 	bool operator==(const Matrix& other) const {
 		if (rows != other.rows || cols != other.cols) return false;
 
 		for (int i = 0; i < rows; ++i) {
 			for (int j = 0; j < cols; ++j) {
-				if (fabs(data[i][j] - other.data[i][j]) > 1e-6) {
+				if (fabs(double(data[i][j]) - double(other.data[i][j])) > 1e-6) {
 					return false;
 				}
 			}
@@ -177,34 +928,422 @@ public:
 	}
 };
 
-void matrix() {
-	const int size = 500;
-	Matrix a(size, size), b(size, size);
-	a.random_fill();
-	b.random_fill();
+// Copy of m rounded to element type To.
+template<typename To, typename From>
+Matrix<To> convert(const Matrix<From>& m) {
+	Matrix<To> result(m.get_rows(), m.get_cols());
+
+#pragma omp parallel for
+	for (int i = 0; i < m.get_rows(); ++i) {
+		for (int j = 0; j < m.get_cols(); ++j) {
+			result.row(i)[j] = To(m.row(i)[j]);
+		}
+	}
+	return result;
+}
+
+// max |x - ref| / max |ref|
+double relative_error(const Matrix<double>& ref, const Matrix<double>& x) {
+	double max_diff = 0.0, max_ref = 0.0;
+	for (int i = 0; i < ref.get_rows(); ++i) {
+		for (int j = 0; j < ref.get_cols(); ++j) {
+			max_diff = max(max_diff, fabs(x.row(i)[j] - ref.row(i)[j]));
+			max_ref = max(max_ref, fabs(ref.row(i)[j]));
+		}
+	}
+	return max_ref > 0.0 ? max_diff / max_ref : max_diff;
+}
+
+// Fixed-point slices of a double matrix in a 16-bit type. Row i of the
+// left operand (column j of the right one) is scaled by its own power of
+// two, exponent[i], so that |m[i][j]| < 2^exponent[i]. Slice p then holds
+// the residual left by the slices before it, rounded to a multiple of
+// 2^(exponent[i] - (p + 1) * bits): an integer below 2^bits in magnitude
+// once that scale is taken out. The residual is kept in double and every
+// step is exact, so the slices add up to m exactly once they reach the
+// last bit of m.
+template<typename Low>
+class Slicer {
+	Matrix<double> residual;
+	vector<int> exponent;
+	bool by_rows;
+	int bits;
+	int count = 0;
+
+public:
+	Slicer(const Matrix<double>& m, bool by_rows, int bits)
+		: residual(m), exponent(by_rows ? m.get_rows() : m.get_cols(), INT_MIN), by_rows(by_rows), bits(bits) {
+		vector<double> max_abs(exponent.size(), 0.0);
+		for (int i = 0; i < m.get_rows(); ++i) {
+			for (int j = 0; j < m.get_cols(); ++j) {
+				double& x = max_abs[by_rows ? i : j];
+				x = max(x, fabs(m.row(i)[j]));
+			}
+		}
+		for (size_t k = 0; k < exponent.size(); ++k) {
+			frexp(max_abs[k], &exponent[k]);
+		}
+	}
+
+	// Scale of slice p for row (or column) k.
+	double scale(int k, int p) const { return ldexp(1.0, exponent[k] - (p + 1) * bits); }
+
+	// The next slice, as integers; its scale is scale(k, slices() - 1).
+	Matrix<Low> next() {
+		const int p = count++;
+		Matrix<Low> slice(residual.get_rows(), residual.get_cols());
+
+#pragma omp parallel for
+		for (int i = 0; i < residual.get_rows(); ++i) {
+			for (int j = 0; j < residual.get_cols(); ++j) {
+				const int e = exponent[by_rows ? i : j] - (p + 1) * bits;
+				const double q = nearbyint(ldexp(residual.row(i)[j], -e));
+				slice.row(i)[j] = Low(float(q));
+				residual.row(i)[j] -= ldexp(q, e);
+			}
+		}
+		return slice;
+	}
+
+	int slices() const { return count; }
+};
+
+// Bits per slice for which a product of two slices is exact in a kernel
+// that multiplies 16-bit operands and accumulates in fp32: each slice value
+// fits the 16-bit mantissa (11 bits fp16, 8 bits bf16), and a sum of inner
+// products below 2^bits * 2^bits fits the 24 bits of fp32. The second
+// limit is the tighter one from 256 inner elements on (8 bits), so from
+// there fp16 and bf16 slice alike. Past 2^22 inner elements no slice width
+// is exact and the result degrades to fp32 accuracy.
+template<typename Low>
+int slice_bits(int inner) {
+	const int mantissa = is_same<Low, pc::half>::value ? 11 : 8;
+	int log_inner = 0;
+	while ((1LL << log_inner) < inner) ++log_inner;
+	return max(1, min(mantissa, (24 - log_inner) / 2));
+}
+
+// Slice products run by refinement orders 1..orders.
+inline int slice_products(int orders) { return orders * (orders + 1) / 2; }
+
+// The plain mixed-precision product: both operands rounded to Low element
+// by element, one gemm with fp32 accumulation.
+template<typename Low>
+Matrix<double> multiply_native(const Matrix<double>& a, const Matrix<double>& b) {
+	Matrix<float> product(a.get_rows(), b.get_cols());
+	pc::gemm(pc::openmp(pc::simd), convert<Low>(a), convert<Low>(b), product);
+	return convert<double>(product);
+}
+
+// A * B to double accuracy from 16-bit products with fp32 accumulation.
+// max_orders = 1 is the native product (multiply_native), the baseline the
+// refinement is measured against. Otherwise A is sliced by rows and B by
+// columns (see Slicer); the product of two
+// slices only involves integers and partial sums below 2^24, so the fp32
+// kernel computes it exactly and rounding happens only when the scaled
+// products are summed in double. Refinement goes by order: order o adds
+// the products a[s] * b[t] with s + t = o, i.e. the part of the residual
+// A * B - C that is `bits` bits below the previous order. It stops when an
+// order no longer changes the result at double precision, or after
+// max_orders orders; orders_used reports how many were needed.
+template<typename Low>
+Matrix<double> multiply_mixed(const Matrix<double>& a, const Matrix<double>& b, int max_orders, int* orders_used = nullptr) {
+	if (max_orders <= 1) {
+		if (orders_used) *orders_used = 1;
+		return multiply_native<Low>(a, b);
+	}
+
+	const int bits = slice_bits<Low>(a.get_cols());
+	Slicer<Low> a_slicer(a, true, bits), b_slicer(b, false, bits);
+	vector<Matrix<Low>> a_slices, b_slices;
+	Matrix<double> result(a.get_rows(), b.get_cols());
+	Matrix<float> partial(a.get_rows(), b.get_cols());
+
+	int order = 0;
+	while (order < max_orders) {
+		a_slices.push_back(a_slicer.next());
+		b_slices.push_back(b_slicer.next());
+		Matrix<double> correction(a.get_rows(), b.get_cols());
+
+		for (int s = 0; s <= order; ++s) {
+			const int t = order - s;
+			pc::gemm(pc::openmp(pc::simd), a_slices[s], b_slices[t], partial);
+
+#pragma omp parallel for
+			for (int i = 0; i < result.get_rows(); ++i) {
+				const double row_scale = a_slicer.scale(i, s);
+				for (int j = 0; j < result.get_cols(); ++j) {
+					correction.row(i)[j] += double(partial.row(i)[j]) * row_scale * b_slicer.scale(j, t);
+				}
+			}
+		}
+
+		double max_correction = 0.0, max_result = 0.0;
+		for (int i = 0; i < result.get_rows(); ++i) {
+			for (int j = 0; j < result.get_cols(); ++j) {
+				result.row(i)[j] += correction.row(i)[j];
+				max_correction = max(max_correction, fabs(correction.row(i)[j]));
+				max_result = max(max_result, fabs(result.row(i)[j]));
+			}
+		}
+		++order;
+		if (max_correction <= ldexp(max_result, -53)) break;
+	}
+	if (orders_used) *orders_used = order;
+	return result;
+}
 
-	auto start = high_resolution_clock::now();
-	Matrix seq_result = a.multiply_sequential(b);
-	auto end = high_resolution_clock::now();
-	auto seq_time = duration_cast<milliseconds>(end - start).count();
+void multiply_tuned(const tune::Config& config, const Matrix<double>& a, const Matrix<double>& b, Matrix<double>& c) {
+	const pc::GemmTiles tiles{ (int)config.get("tile_k", 0), (int)config.get("tile_j", 0) };
+	const int threads = (int)config.get("threads", 0);
+	switch (config.get("simd_width", 2)) {
+	case 4: pc::gemm(pc::openmp(pc::avx, threads), a, b, c, tiles); break;
+	case 2: pc::gemm(pc::openmp(pc::simd, threads), a, b, c, tiles); break;
+	default: pc::gemm(pc::openmp(pc::seq, threads), a, b, c, tiles); break;
+	}
+}
 
-	start = high_resolution_clock::now();
-	Matrix par_result = a.multiply_parallel(b);
-	end = high_resolution_clock::now();
-	auto par_time = duration_cast<milliseconds>(end - start).count();
+// OpenMP thread count, cache tiles and vector width (scalar, SSE or AVX) for
+// the policy multiply, searched once per machine and size bucket and then
+// read from the tune cache.
+tune::Config tune_multiply(tune::Tuner& tuner, const Matrix<double>& a, const Matrix<double>& b) {
+	const vector<tune::Param> space = {
+		{ "threads", tune::thread_candidates() },
+		{ "tile_k", { 0, 64, 128, 256 } },
+		{ "tile_j", { 0, 256, 512, 1024 } },
+		{ "simd_width", tune::simd_width_candidates(sizeof(double)) },
+	};
+	Matrix<double> c(a.get_rows(), b.get_cols());
+	return tuner.tune("ParaComp4.multiply", a.get_rows(), space, [&](const tune::Config& config) {
+		return tune::time_min_ms([&] { multiply_tuned(config, a, b, c); });
+		});
+}
 
+void matrix(bench::Suite& suite, tune::Tuner& tuner) {
 	cout << "=== Matrix mult ===" << endl;
-	cout << "Size: " << size << "x" << size << endl;
-	cout << "Sequential time: " << seq_time << " ms" << endl;
-	cout << "Parallel time: " << par_time << " ms" << endl;
+	for (long long size : suite.options().get_list("size", { 500 })) {
+		const string params = bench::params({ { "size", size } });
+		const double flops = 2.0 * size * size * size;
+
+		Matrix<double> a((int)size, (int)size), b((int)size, (int)size);
+		a.random_fill(1);
+		b.random_fill(2);
+
+		Matrix<double> seq_result, par_result;
+		suite.run("multiply_sequential", params, bench::flops(flops), [&] { seq_result = a.multiply_sequential(b); });
+		suite.run("multiply_parallel", params, bench::flops(flops), [&] { par_result = a.multiply_parallel(b); });
+		Matrix<double> policy_result((int)size, (int)size);
+		suite.run("multiply_policy", params + " policy=openmp+simd", bench::flops(flops), [&] { pc::gemm(pc::openmp(pc::simd), a, b, policy_result); });
+
+		const tune::Config tuned = tune_multiply(tuner, a, b);
+		Matrix<double> tuned_result((int)size, (int)size);
+		suite.run("multiply_tuned", params + " " + tuned.to_string(), bench::flops(flops), [&] { multiply_tuned(tuned, a, b, tuned_result); });
+
+		Matrix<double> transposed_result;
+		suite.run("multiply_transposed", params, bench::flops(flops), [&] { transposed_result = a.multiply_transposed(b); });
+
+		cout << "Results match: " << (seq_result == par_result && seq_result == policy_result && seq_result == tuned_result
+			&& seq_result == transposed_result ? "yes" : "no") << endl;
+
+		const Matrix<float> af = convert<float>(a), bf = convert<float>(b);
+		Matrix<float> float_result((int)size, (int)size);
+		suite.run("multiply_policy", params + " policy=openmp+simd type=float", bench::flops(flops), [&] { pc::gemm(pc::openmp(pc::simd), af, bf, float_result); });
+		cout << "float: relative error " << relative_error(policy_result, convert<double>(float_result)) << endl;
+
+		// Orders are capped at max_orders; the last entry is high enough for
+		// the refinement to stop on its own at double accuracy. One untimed
+		// run finds how many orders are used, so the reported throughput
+		// counts every slice gemm that was executed.
+		for (long long max_orders : suite.options().get_list("mixed-orders", { 1, 2, 16 })) {
+			const string mixed_params = bench::params({ { "size", size }, { "max_orders", max_orders } });
+			int fp16_orders = 0, bf16_orders = 0;
+			const Matrix<double> fp16_result = multiply_mixed<pc::half>(a, b, (int)max_orders, &fp16_orders);
+			const Matrix<double> bf16_result = multiply_mixed<pc::bfloat16>(a, b, (int)max_orders, &bf16_orders);
+			Matrix<double> timed_result;
+			suite.run("multiply_mixed", mixed_params + " type=fp16", bench::flops(flops * slice_products(fp16_orders)),
+				[&] { timed_result = multiply_mixed<pc::half>(a, b, (int)max_orders); });
+			suite.run("multiply_mixed", mixed_params + " type=bf16", bench::flops(flops * slice_products(bf16_orders)),
+				[&] { timed_result = multiply_mixed<pc::bfloat16>(a, b, (int)max_orders); });
+			cout << "fp16 x" << fp16_orders << ": relative error " << relative_error(policy_result, fp16_result)
+				<< ", bf16 x" << bf16_orders << ": relative error " << relative_error(policy_result, bf16_result) << endl;
+		}
+	}
+}
+
+// Max error of solve() on A x = b with the known solution x = 1, 2, ..., n.
+template<typename Solve>
+double solve_error(const Matrix<double>& a, Solve solve) {
+	const int n = a.get_rows();
+	vector<double> b(n, 0.0);
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < n; ++j) b[i] += a.row(i)[j] * (j + 1);
+	}
+	solve(b);
+	double error = 0.0;
+	for (int i = 0; i < n; ++i) error = max(error, fabs(b[i] - (i + 1)));
+	return error;
 }
 
-int main() {
+// Tiled LU and Cholesky with the DAG scheduler against the same tile tasks
+// run in fork-join stages. OpenMP 2.0 has no task construct, so the tile
+// tasks run on a pc::ThreadPool with as many threads as OpenMP uses. The
+// timed body includes copying the input.
+void factorize(bench::Suite& suite) {
+	cout << "=== Factorizations ===" << endl;
+	const int tile = (int)suite.options().get_int("factor-tile", 64);
+	const int thread_count = omp_get_max_threads();
+	pc::ThreadPool pool(thread_count);
+
+	for (long long size : suite.options().get_list("factor-size", { 500 })) {
+		const int n = (int)size;
+		const string params = bench::params({ { "size", size }, { "threads", thread_count }, { "tile", tile } });
+		const double n3 = (double)n * n * n;
+
+		Matrix<double> a(n, n);
+		a.random_fill(5);
+
+		// A * A^T + n * I is symmetric positive definite.
+		Matrix<double> spd(n, n);
+		pc::gemm(pc::openmp(pc::simd), a, a.transpose(), spd);
+		for (int i = 0; i < n; ++i) spd.row(i)[i] += n;
+
+		vector<int> pivots;
+		Matrix<double> lu, l;
+		const pair<const char*, pc::Schedule> schedules[] = { { "dag", pc::Schedule::dag }, { "fork_join", pc::Schedule::fork_join } };
+		for (const auto& s : schedules) {
+			suite.run(string("lu_") + s.first, params, bench::flops(2.0 * n3 / 3.0), [&] {
+				lu = a;
+				pc::lu_factorize(pool, lu, pivots, tile, s.second);
+				});
+			suite.run(string("cholesky_") + s.first, params, bench::flops(n3 / 3.0), [&] {
+				l = spd;
+				pc::cholesky_factorize(pool, l, tile, s.second);
+				});
+		}
+
+		cout << "LU solve error: " << solve_error(a, [&](vector<double>& b) { pc::lu_solve(lu, pivots, b); }) << endl;
+		cout << "Cholesky solve error: " << solve_error(spd, [&](vector<double>& b) { pc::cholesky_solve(l, b); }) << endl;
+	}
+}
+
+// Transposes and matrix-vector products, checked against plain loops.
+void matvec(bench::Suite& suite) {
+	cout << "=== Transpose and matrix-vector ===" << endl;
+	for (long long size : suite.options().get_list("matvec-size", { 4000 })) {
+		const int n = (int)size;
+		const string params = bench::params({ { "size", size } });
+		const double bytes = (double)size * size * sizeof(double);
+
+		Matrix<double> a(n, n);
+		a.random_fill(3);
+		vector<double> x(n);
+		for (int i = 0; i < n; ++i) x[i] = 1.0 / (1 + i % 10);
+
+		Matrix<double> at;
+		suite.run("transpose", params, bench::bytes(2 * bytes), [&] { at = a.transpose(); });
+		Matrix<double> square = a;
+		suite.run("transpose_in_place", params, bench::bytes(2 * bytes), [&] { square.transpose_in_place(); });
+
+		bool transpose_ok = true;
+		for (int i = 0; i < n && transpose_ok; ++i) {
+			for (int j = 0; j < n; ++j) transpose_ok = transpose_ok && at.row(j)[i] == a.row(i)[j];
+		}
+		square = a;
+		square.transpose_in_place();
+		transpose_ok = transpose_ok && square == at;
+
+		vector<double> ax, xa;
+		suite.run("gemv", params, bench::bytes(bytes), [&] { ax = a.multiply_vector(x); });
+		suite.run("gevm", params, bench::bytes(bytes), [&] { xa = a.vector_multiply(x); });
+
+		vector<double> ax_ref(n, 0.0), xa_ref(n, 0.0);
+		for (int i = 0; i < n; ++i) {
+			for (int j = 0; j < n; ++j) {
+				ax_ref[i] += a.row(i)[j] * x[j];
+				xa_ref[j] += x[i] * a.row(i)[j];
+			}
+		}
+		double gemv_error = 0.0, gevm_error = 0.0;
+		for (int i = 0; i < n; ++i) {
+			gemv_error = max(gemv_error, fabs(ax[i] - ax_ref[i]) / fabs(ax_ref[i]));
+			gevm_error = max(gevm_error, fabs(xa[i] - xa_ref[i]) / fabs(xa_ref[i]));
+		}
+
+		cout << "Transpose: " << (transpose_ok ? "ok" : "MISMATCH") << endl;
+		cout << "GEMV: relative error " << gemv_error << ", GEVM: relative error " << gevm_error << endl;
+	}
+}
+
+// Element (i, j) gets number i * cols + j of the seed's sequence, the same
+// value Matrix::random_fill gives it, written straight into the mapping.
+template<typename T>
+void random_fill(mf::MatrixView<T>& view, uint64_t seed) {
+	const rng::Philox4x32 gen(seed);
+	const int rows = view.get_rows(), cols = view.get_cols(), tile = view.get_tile();
+
+#pragma omp parallel for
+	for (int i = 0; i < rows; ++i) {
+		for (int tj = 0; tj < view.get_tile_cols(); ++tj) {
+			int first = tj * tile;
+			T* dst = view.tile_data(i / tile, tj) + (size_t)(i % tile) * tile;
+			rng::uniform_real(gen, (uint64_t)i * cols + first, dst, min(tile, cols - first), 0.0, 10.0);
+		}
+	}
+}
+
+void out_of_core(bench::Suite& suite) {
+	cout << "=== Out-of-core multiply ===" << endl;
+	const string dir = suite.options().get_string("ooc-dir", ".");
+	const int tile = (int)suite.options().get_int("tile", 256);
+
+	for (long long size : suite.options().get_list("ooc-size", { 1000 })) {
+		const int n = (int)size;
+		const string params = bench::params({ { "size", size }, { "tile", tile } });
+		const string a_path = dir + "/ooc_a.pcm", b_path = dir + "/ooc_b.pcm", c_path = dir + "/ooc_c.pcm";
+
+		{
+			auto a = mf::MatrixView<double>::create(a_path, n, n, tile);
+			auto b = mf::MatrixView<double>::create(b_path, n, n, tile);
+			auto c = mf::MatrixView<double>::create(c_path, n, n, tile);
+			random_fill(a, 1);
+			random_fill(b, 2);
+			suite.run("ooc_multiply", params, bench::flops(2.0 * size * size * size), [&] { mf::multiply(pc::openmp(pc::simd), a, b, c); });
+		}
+
+		Matrix<double> result(n, n);
+		suite.run("ooc_load", params, bench::bytes((double)size * size * sizeof(double)), [&] {
+			auto c = mf::MatrixView<double>::open(c_path);
+			mf::load(c, result);
+			});
+
+		if (size <= 2000) {
+			Matrix<double> a(n, n), b(n, n), expected(n, n);
+			a.random_fill(1);
+			b.random_fill(2);
+			pc::gemm(pc::openmp(pc::simd), a, b, expected);
+			cout << "Out-of-core result: relative error " << relative_error(expected, result) << endl;
+		}
+
+		remove(a_path.c_str());
+		remove(b_path.c_str());
+		remove(c_path.c_str());
+	}
+}
+
+int main(int argc, char** argv) {
 	omp_set_num_threads(omp_get_num_procs());
 
-	pi();
-	sort();
-	matrix();
+	bench::Suite suite("ParaComp4", argc, argv);
+	tune::Tuner tuner(suite.options().get_string("tune-cache", tune::default_cache_path()), suite.options().has("retune"));
+
+	pi(suite, tuner);
+	primitives(suite);
+	sort(suite);
+	matrix(suite, tuner);
+	factorize(suite);
+	matvec(suite);
+	out_of_core(suite);
 
-	return 0;
+	perf::report();
+	return suite.report();
 }
\ No newline at end of file
@@ -1,6 +1,15 @@
 ﻿#include <iostream>
 #include <chrono>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <functional>
 #include <mpi.h>
+#include "../../Common/benchmark.h"
+#include "../../Common/mpi_shared.h"
+#include "../../Common/philox.h"
+#include "../../Common/policy.h"
 
 float rectangle(float a, float b, int n, float (*f)(float)) {
 	float h = (b - a) / n;
@@ -114,84 +123,385 @@ float test_function(float x) {
 	return 4.0f / (1.0f + x * x);
 }
 
+// Сумма Симпсона по готовой таблице значений функции для точек [begin, end)
+double table_simpson(const float* table, long long intervals, long long begin, long long end) {
+	double sum = 0.0;
+	for (long long i = begin; i < end; ++i) {
+		sum += pc::simpson_rule::weight(i, intervals) * table[i];
+	}
+	return sum;
+}
+
+// Примитивы для MPI: каждый процесс обрабатывает свой фрагмент,
+// затем результаты согласуются коллективными операциями.
+template<typename T> MPI_Datatype mpi_type();
+template<> MPI_Datatype mpi_type<int>() { return MPI_INT; }
+template<> MPI_Datatype mpi_type<float>() { return MPI_FLOAT; }
+template<> MPI_Datatype mpi_type<double>() { return MPI_DOUBLE; }
+template<> MPI_Datatype mpi_type<long long>() { return MPI_LONG_LONG; }
+
+template<typename T>
+struct Max {
+	T operator()(const T& a, const T& b) const { return a > b ? a : b; }
+};
+
+// Обёртка пользовательской ассоциативной операции для MPI_Op_create
+template<typename T, typename Op>
+void mpi_user_op(void* in, void* inout, int* len, MPI_Datatype*) {
+	T* a = static_cast<T*>(in);
+	T* b = static_cast<T*>(inout);
+	for (int i = 0; i < *len; ++i) b[i] = Op()(a[i], b[i]);
+}
+
+template<typename T, typename Op>
+T reduce_mpi(const std::vector<T>& local, T identity, MPI_Comm comm) {
+	Op op;
+	T acc = identity;
+	for (const T& x : local) acc = op(acc, x);
+
+	// Операция не объявлена коммутативной: MPI сохраняет порядок рангов
+	MPI_Op mpi_op;
+	MPI_Op_create(&mpi_user_op<T, Op>, 0, &mpi_op);
+	T result = identity;
+	MPI_Allreduce(&acc, &result, 1, mpi_type<T>(), mpi_op, comm);
+	MPI_Op_free(&mpi_op);
+	return result;
+}
+
+// Глобальное включающее сканирование: локальный проход плюс MPI_Exscan сумм фрагментов
+template<typename T>
+void inclusive_scan_mpi(std::vector<T>& local, MPI_Comm comm) {
+	int rank;
+	MPI_Comm_rank(comm, &rank);
+
+	T local_total = 0;
+	for (auto& x : local) {
+		local_total += x;
+		x = local_total;
+	}
+
+	T offset = 0;
+	MPI_Exscan(&local_total, &offset, 1, mpi_type<T>(), MPI_SUM, comm);
+	// На нулевом процессе результат MPI_Exscan не определён
+	if (rank == 0) offset = 0;
+
+	for (auto& x : local) x += offset;
+}
+
+template<typename T, typename BinOf>
+std::vector<long long> histogram_mpi(const std::vector<T>& local, int bins, BinOf bin_of, MPI_Comm comm) {
+	std::vector<long long> local_hist(bins, 0), hist(bins, 0);
+	for (const T& x : local) ++local_hist[bin_of(x)];
+	MPI_Allreduce(local_hist.data(), hist.data(), bins, MPI_LONG_LONG, MPI_SUM, comm);
+	return hist;
+}
+
+// Сжатие потока: возвращает отобранные элементы и их глобальное смещение
+template<typename T, typename Pred>
+std::vector<T> compact_mpi(const std::vector<T>& local, Pred pred, long long& global_offset, MPI_Comm comm) {
+	int rank;
+	MPI_Comm_rank(comm, &rank);
+
+	std::vector<T> kept;
+	for (const T& x : local) {
+		if (pred(x)) kept.push_back(x);
+	}
+
+	long long count = (long long)kept.size();
+	global_offset = 0;
+	MPI_Exscan(&count, &global_offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+	if (rank == 0) global_offset = 0;
+	return kept;
+}
+
+// Распределённая сортировка выборкой (samplesort):
+// каждый процесс сортирует свою часть, по регулярной выборке выбираются
+// разделители, ключи перераспределяются через MPI_Alltoallv и сливаются локально.
+void samplesort_mpi(std::vector<int>& local, MPI_Comm comm) {
+	int rank, size;
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &size);
+
+	std::sort(local.begin(), local.end());
+	if (size == 1) return;
+
+	// Регулярная выборка: до size - 1 элементов с каждого процесса.
+	// Пустые процессы не присылают ничего, чтобы не смещать разделители.
+	const int n = (int)local.size();
+	const int sample_count = std::min(size - 1, n);
+	std::vector<int> samples(sample_count);
+	for (int i = 0; i < sample_count; ++i) {
+		samples[i] = local[(long long)n * (i + 1) / (sample_count + 1)];
+	}
+
+	std::vector<int> sample_counts(size), sample_displs(size);
+	MPI_Allgather(&sample_count, 1, MPI_INT, sample_counts.data(), 1, MPI_INT, comm);
+	int total_samples = 0;
+	for (int i = 0; i < size; ++i) {
+		sample_displs[i] = total_samples;
+		total_samples += sample_counts[i];
+	}
+	if (total_samples == 0) return;
+
+	std::vector<int> all_samples(total_samples);
+	MPI_Allgatherv(samples.data(), sample_count, MPI_INT,
+		all_samples.data(), sample_counts.data(), sample_displs.data(), MPI_INT, comm);
+	std::sort(all_samples.begin(), all_samples.end());
+
+	std::vector<int> splitters(size - 1);
+	for (int i = 0; i < size - 1; ++i) {
+		splitters[i] = all_samples[(long long)total_samples * (i + 1) / size];
+	}
+
+	// Локальные данные уже отсортированы, поэтому границы блоков находятся бинарным поиском
+	std::vector<int> send_counts(size), send_displs(size);
+	int begin = 0;
+	for (int i = 0; i < size; ++i) {
+		int end = (i == size - 1) ? n
+			: (int)(std::upper_bound(local.begin() + begin, local.end(), splitters[i]) - local.begin());
+		send_displs[i] = begin;
+		send_counts[i] = end - begin;
+		begin = end;
+	}
+
+	std::vector<int> recv_counts(size), recv_displs(size);
+	MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, comm);
+
+	int total = 0;
+	for (int i = 0; i < size; ++i) {
+		recv_displs[i] = total;
+		total += recv_counts[i];
+	}
+
+	std::vector<int> received(total);
+	MPI_Alltoallv(local.data(), send_counts.data(), send_displs.data(), MPI_INT,
+		received.data(), recv_counts.data(), recv_displs.data(), MPI_INT, comm);
+
+	// Попарное слияние size отсортированных блоков
+	for (int width = 1; width < size; width *= 2) {
+		for (int i = 0; i + width < size; i += 2 * width) {
+			int mid = recv_displs[i + width];
+			int last = (i + 2 * width < size) ? recv_displs[i + 2 * width] : total;
+			std::inplace_merge(received.begin() + recv_displs[i], received.begin() + mid, received.begin() + last);
+		}
+	}
+
+	local.swap(received);
+}
+
+// Пара (есть данные, последний ключ); операция оставляет более правый непустой процесс.
+// MPI передаёт в invec вклад младших рангов, поэтому операция некоммутативна
+void last_key_op(void* invec, void* inoutvec, int* len, MPI_Datatype*) {
+	const int* in = static_cast<const int*>(invec);
+	int* inout = static_cast<int*>(inoutvec);
+	for (int i = 0; i < *len; ++i) {
+		if (!inout[2 * i]) {
+			inout[2 * i] = in[2 * i];
+			inout[2 * i + 1] = in[2 * i + 1];
+		}
+	}
+}
+
+// Проверка глобальной упорядоченности и отчёт о дисбалансе разбиения
+void samplesort_report(const std::vector<int>& local, long long expected_total, MPI_Comm comm) {
+	int rank, size;
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &size);
+
+	int locally_sorted = std::is_sorted(local.begin(), local.end()) ? 1 : 0;
+
+	// Первый элемент процесса должен быть не меньше последнего элемента
+	// ближайшего непустого процесса слева; пустые процессы пропускаются
+	int my_last[2] = { local.empty() ? 0 : 1, local.empty() ? 0 : local.back() };
+	int prev_last[2] = { 0, 0 };
+	MPI_Op last_key;
+	MPI_Op_create(last_key_op, 0, &last_key);
+	MPI_Exscan(my_last, prev_last, 1, MPI_2INT, last_key, comm);
+	MPI_Op_free(&last_key);
+	// На нулевом процессе результат Exscan не определён
+	if (rank > 0 && prev_last[0] && !local.empty() && prev_last[1] > local.front()) locally_sorted = 0;
+
+	int all_sorted = 0;
+	MPI_Reduce(&locally_sorted, &all_sorted, 1, MPI_INT, MPI_LAND, 0, comm);
+
+	long long count = (long long)local.size();
+	long long total = 0, max_count = 0, min_count = 0;
+	MPI_Reduce(&count, &total, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+	MPI_Reduce(&count, &max_count, 1, MPI_LONG_LONG, MPI_MAX, 0, comm);
+	MPI_Reduce(&count, &min_count, 1, MPI_LONG_LONG, MPI_MIN, 0, comm);
+
+	if (rank == 0) {
+		double average = (double)total / size;
+		std::cout << "  Sorted: " << (all_sorted && total == expected_total ? "yes" : "NO") << "\n";
+		std::cout << "  Keys per rank: min " << min_count << ", max " << max_count << ", avg " << average << "\n";
+		std::cout << "  Imbalance (max/avg): " << (average > 0 ? max_count / average : 0.0) << "\n";
+	}
+}
+
 int main(int argc, char** argv) {
 	MPI_Init(&argc, &argv);
 
 	int rank;
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
+	int world_size;
+	MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
 	const float a = 0.0f;
 	const float b = 1.0f;
-	const int n = 1000000;
 	const float exact_pi = 3.141592653589793f;
 
-	if (rank == 0) {
-		// Seq
-		auto start = std::chrono::high_resolution_clock::now();
-		float pi_rect = rectangle(a, b, n, test_function);
-		auto stop = std::chrono::high_resolution_clock::now();
-		auto duration_rect = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-		start = std::chrono::high_resolution_clock::now();
-		float pi_trap = trapezoid(a, b, n, test_function);
-		stop = std::chrono::high_resolution_clock::now();
-		auto duration_trap = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-		start = std::chrono::high_resolution_clock::now();
-		float pi_simp = simpson(a, b, n, test_function);
-		stop = std::chrono::high_resolution_clock::now();
-		auto duration_simp = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-		std::cout << "Sequential results:\n";
-		std::cout << "Rectangles:\n";
-		std::cout << "  Result: " << pi_rect << " (error: " << fabs(pi_rect - exact_pi) << ")\n";
-		std::cout << "  Time: " << duration_rect.count() << " microsec\n";
-
-		std::cout << "Trapezoids:\n";
-		std::cout << "  Result: " << pi_trap << " (error: " << fabs(pi_trap - exact_pi) << ")\n";
-		std::cout << "  Time: " << duration_trap.count() << " microsec\n";
-
-		std::cout << "Simpson:\n";
-		std::cout << "  Result: " << pi_simp << " (error: " << fabs(pi_simp - exact_pi) << ")\n";
-		std::cout << "  Time: " << duration_simp.count() << " microsec\n\n";
-	}
-
-	// MPI
-	MPI_Barrier(MPI_COMM_WORLD);
-	auto start = std::chrono::high_resolution_clock::now();
-	float mpi_rect = rectangle_mpi(a, b, n, test_function);
-	auto stop = std::chrono::high_resolution_clock::now();
-	auto duration_mpi_rect = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-	MPI_Barrier(MPI_COMM_WORLD);
-	start = std::chrono::high_resolution_clock::now();
-	float mpi_trap = trapezoid_mpi(a, b, n, test_function);
-	stop = std::chrono::high_resolution_clock::now();
-	auto duration_mpi_trap = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-	MPI_Barrier(MPI_COMM_WORLD);
-	start = std::chrono::high_resolution_clock::now();
-	float mpi_simp = simpson_mpi(a, b, n, test_function);
-	stop = std::chrono::high_resolution_clock::now();
-	auto duration_mpi_simp = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+	// Замеры печатает и сохраняет только нулевой процесс
+	bench::Suite suite("ParaComp5", argc, argv);
+	suite.set_reporting(rank == 0);
+	const std::string np = std::to_string(world_size);
+
+	for (long long n : suite.options().get_list("n", { 1000000 })) {
+		const int ni = (int)n;
+		const std::string params = bench::params({ { "n", n } });
+
+		if (rank == 0) {
+			// Seq
+			float pi_rect = 0, pi_trap = 0, pi_simp = 0;
+			suite.run("rectangle", params, bench::evals(n), [&] { pi_rect = rectangle(a, b, ni, test_function); });
+			suite.run("trapezoid", params, bench::evals(n), [&] { pi_trap = trapezoid(a, b, ni, test_function); });
+			suite.run("simpson", params, bench::evals(n), [&] { pi_simp = simpson(a, b, ni, test_function); });
+
+			std::cout << "Sequential results:\n";
+			std::cout << "  Rectangles: " << pi_rect << " (error: " << fabs(pi_rect - exact_pi) << ")\n";
+			std::cout << "  Trapezoids: " << pi_trap << " (error: " << fabs(pi_trap - exact_pi) << ")\n";
+			std::cout << "  Simpson: " << pi_simp << " (error: " << fabs(pi_simp - exact_pi) << ")\n\n";
+		}
+
+		// MPI: перед каждым замером процессы синхронизируются барьером
+		suite.set_sync([] { MPI_Barrier(MPI_COMM_WORLD); });
+		const std::string mpi_params = params + " np=" + np;
+		float mpi_rect = 0, mpi_trap = 0, mpi_simp = 0;
+		suite.run("rectangle_mpi", mpi_params, bench::evals(n), [&] { mpi_rect = rectangle_mpi(a, b, ni, test_function); });
+		suite.run("trapezoid_mpi", mpi_params, bench::evals(n), [&] { mpi_trap = trapezoid_mpi(a, b, ni, test_function); });
+		suite.run("simpson_mpi", mpi_params, bench::evals(n), [&] { mpi_simp = simpson_mpi(a, b, ni, test_function); });
+		float policy_simp = 0;
+		suite.run("integrate_simpson", mpi_params + " policy=mpi+simd", bench::evals(n), [&] {
+			policy_simp = pc::integrate(pc::mpi(MPI_COMM_WORLD, pc::simd), pc::simpson, test_function, a, b, n);
+			});
+		suite.set_sync(nullptr);
+
+		if (rank == 0) {
+			std::cout << "MPI parallel results:\n";
+			std::cout << "  Rectangles (MPI): " << mpi_rect << " (error: " << fabs(mpi_rect - exact_pi) << ")\n";
+			std::cout << "  Trapezoids (MPI): " << mpi_trap << " (error: " << fabs(mpi_trap - exact_pi) << ")\n";
+			std::cout << "  Simpson (MPI): " << mpi_simp << " (error: " << fabs(mpi_simp - exact_pi) << ")\n";
+			std::cout << "  Simpson (mpi+simd policy): " << policy_simp << " (error: " << fabs(policy_simp - exact_pi) << ")\n\n";
+		}
+	}
 
-	if (rank == 0) {
-		std::cout << "MPI parallel results:\n";
-		std::cout << "Rectangles (MPI):\n";
-		std::cout << "  Result: " << mpi_rect << " (error: " << fabs(mpi_rect - exact_pi) << ")\n";
-		std::cout << "  Time: " << duration_mpi_rect.count() << " microsec\n";
+	// Таблица значений функции: частная копия в каждом процессе против одной
+	// копии на узел в окне разделяемой памяти, которую процессы узла заполняют
+	// по частям. Суммы складываются иерархически: сначала внутри узла через
+	// разделяемую память, затем между узлами
+	{
+		const long long table_n = suite.options().get_int("table-n", 1000000);
+		const long long intervals = pc::simpson_rule::intervals(table_n);
+		const long long points = intervals + 1;
+		const float h = (b - a) / intervals;
+		auto value = [&](long long i) { return test_function(a + i * h); };
+		long long begin, end;
+		pc::split_range(0, points, world_size, rank, begin, end);
+
+		pc::NodeComm nodes(MPI_COMM_WORLD);
+		const std::string table_params = bench::params({ { "n", table_n } }) + " np=" + np
+			+ " nodes=" + std::to_string(nodes.node_count);
+
+		suite.set_sync([] { MPI_Barrier(MPI_COMM_WORLD); });
+		std::vector<float> private_table;
+		suite.run("table_private", table_params, bench::evals((double)points), [&] {
+			private_table.resize(points);
+			for (long long i = 0; i < points; ++i) private_table[i] = value(i);
+			});
+		pc::SharedArray<float> shared_table(nodes, points);
+		suite.run("table_shared", table_params, bench::evals((double)points), [&] { shared_table.fill(value); });
+
+		pc::NodeReducer<double> reducer(nodes);
+		double pi_private = 0, pi_shared = 0;
+		float pi_policy = 0;
+		suite.run("table_simpson_allreduce", table_params, bench::evals((double)points), [&] {
+			double local = table_simpson(private_table.data(), intervals, begin, end), global = 0.0;
+			MPI_Allreduce(&local, &global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+			pi_private = global * h / 3.0;
+			});
+		suite.run("table_simpson_hierarchical", table_params, bench::evals((double)points), [&] {
+			pi_shared = reducer.allreduce(table_simpson(shared_table.data(), intervals, begin, end)) * h / 3.0;
+			});
+		suite.run("integrate_simpson", table_params + " policy=node_mpi+simd", bench::evals((double)points), [&] {
+			pi_policy = pc::integrate(pc::node_mpi(reducer, pc::simd), pc::simpson, test_function, a, b, table_n);
+			});
+		suite.set_sync(nullptr);
+
+		int max_node_size = 0;
+		MPI_Reduce(&nodes.node_size, &max_node_size, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+		if (rank == 0) {
+			const double table_mb = points * sizeof(float) / 1048576.0;
+			std::cout << "Integrand table (" << nodes.node_count << " node(s), up to " << max_node_size << " rank(s) per node):\n";
+			std::cout << "  Private copies: " << table_mb * world_size << " MB, shared windows: " << table_mb * nodes.node_count << " MB\n";
+			std::cout << "  Simpson (private table, Allreduce): " << pi_private << " (error: " << fabs(pi_private - exact_pi) << ")\n";
+			std::cout << "  Simpson (shared table, hierarchical): " << pi_shared << " (error: " << fabs(pi_shared - exact_pi) << ")\n";
+			std::cout << "  Simpson (node_mpi+simd policy): " << pi_policy << " (error: " << fabs(pi_policy - exact_pi) << ")\n\n";
+		}
+	}
+
+	// Распределённая сортировка
+	const int keys_per_rank = (int)suite.options().get_int("keys", 1000000);
+
+	// Ключи берутся из одной последовательности по глобальному индексу, поэтому
+	// общий набор ключей не зависит от числа процессов
+	const rng::Philox4x32 gen(12345);
+	std::vector<int> source(keys_per_rank), keys;
+	rng::uniform_int(gen, (uint64_t)rank * keys_per_rank, source.data(), keys_per_rank, 1, 100000000);
 
-		std::cout << "Trapezoids (MPI):\n";
-		std::cout << "  Result: " << mpi_trap << " (error: " << fabs(mpi_trap - exact_pi) << ")\n";
-		std::cout << "  Time: " << duration_mpi_trap.count() << " microsec\n";
+	// Барьер в конце замера: время определяется самым медленным процессом
+	suite.set_sync([] { MPI_Barrier(MPI_COMM_WORLD); });
+	suite.run("samplesort_mpi", bench::params({ { "keys", keys_per_rank } }) + " np=" + np,
+		bench::items((double)keys_per_rank * world_size), [&] {
+			keys = source;
+			samplesort_mpi(keys, MPI_COMM_WORLD);
+			MPI_Barrier(MPI_COMM_WORLD);
+		});
+	suite.set_sync(nullptr);
 
-		std::cout << "Simpson (MPI):\n";
-		std::cout << "  Result: " << mpi_simp << " (error: " << fabs(mpi_simp - exact_pi) << ")\n";
-		std::cout << "  Time: " << duration_mpi_simp.count() << " microsec\n";
+	samplesort_report(keys, (long long)keys_per_rank * world_size, MPI_COMM_WORLD);
+
+	// Примитивы на отсортированных ключах
+	long long checksum = reduce_mpi<long long, std::plus<long long>>(
+		std::vector<long long>(keys.begin(), keys.end()), 0LL, MPI_COMM_WORLD);
+	int global_max = reduce_mpi<int, Max<int>>(keys, INT_MIN, MPI_COMM_WORLD);
+
+	std::vector<long long> ones(keys.size(), 1);
+	inclusive_scan_mpi(ones, MPI_COMM_WORLD);
+
+	std::vector<long long> hist = histogram_mpi(keys, 10, [](int key) { return (key - 1) / 10000000; }, MPI_COMM_WORLD);
+
+	long long kept_offset = 0;
+	std::vector<int> kept = compact_mpi(keys, [](int key) { return key % 1000 == 0; }, kept_offset, MPI_COMM_WORLD);
+
+	// Сканирование монотонно, поэтому его последний элемент — максимум по всем процессам
+	long long scan_end = ones.empty() ? 0 : ones.back();
+	long long kept_end = kept_offset + (long long)kept.size();
+	long long global_scan_end = 0, global_kept_end = 0;
+	MPI_Reduce(&scan_end, &global_scan_end, 1, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+	MPI_Reduce(&kept_end, &global_kept_end, 1, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+
+	if (rank == 0) {
+		std::cout << "Primitives (MPI):\n";
+		std::cout << "  Key checksum: " << checksum << ", max key: " << global_max << "\n";
+		std::cout << "  Histogram:";
+		for (long long c : hist) std::cout << " " << c;
+		std::cout << "\n";
+		std::cout << "  Scan of ones: " << global_scan_end << ", compacted keys: " << global_kept_end << "\n";
 	}
 
+	int status = suite.report();
 	MPI_Finalize();
 
 	// mpiexec -np 4 C:\Users\rassu\Repos\paracomp\ParaComp5\x64\Debug\ParaComp5.exe
-	return 0;
+	return status;
 }
\ No newline at end of file
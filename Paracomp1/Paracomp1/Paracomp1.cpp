@@ -1,9 +1,13 @@
 ﻿#include <iostream>
 #include <immintrin.h> 
 #include <chrono>
+#include "../../Common/benchmark.h"
+#include "../../Common/perf_counters.h"
+#include "../../Common/policy.h"
 
 
 float rectangle(float a, float b, int n, float (*f)(float)) {
+	perf::Region region("rectangle", 4.0 * n);
 	float h = (b - a) / n;
 	float sum = 0.0f;
 	for (int i = 0; i < n; ++i) {
@@ -13,6 +17,7 @@ float rectangle(float a, float b, int n, float (*f)(float)) {
 }
 
 float trapezoid(float a, float b, int n, float (*f)(float)) {
+	perf::Region region("trapezoid", 4.0 * n);
 	float h = (b - a) / n;
 	float sum = 0.5f * (f(a) + f(b));
 	for (int i = 1; i < n; ++i) {
@@ -22,6 +27,7 @@ float trapezoid(float a, float b, int n, float (*f)(float)) {
 }
 
 float simpson(float a, float b, int n, float (*f)(float)) {
+	perf::Region region("simpson", 4.0 * n);
 	if (n % 2 != 0) n++;
 	float h = (b - a) / n;
 	float sum = f(a) + f(b);
@@ -46,7 +52,14 @@ __m128 test_function_simd(__m128 x) {
 	return result;
 }
 
+// Integrand for the policy API: the __m128 overload is picked up by pc::simd.
+struct TestFunction {
+	float operator()(float x) const { return test_function(x); }
+	__m128 operator()(__m128 x) const { return test_function_simd(x); }
+};
+
 float rectangle_simd(float a, float b, int n, float (*f)(float)) {
+	perf::Region region("rectangle_simd", 4.0 * n);
 	float h = (b - a) / n;
 	__m128 sum = _mm_setzero_ps();
 	for (int i = 0; i < n; i += 4) {
@@ -61,6 +74,7 @@ float rectangle_simd(float a, float b, int n, float (*f)(float)) {
 }
 
 float trapezoid_simd(float a, float b, int n) {
+	perf::Region region("trapezoid_simd", 4.0 * n);
 	float h = (b - a) / n;
 	__m128 sum = _mm_setzero_ps();
 
@@ -81,6 +95,7 @@ float trapezoid_simd(float a, float b, int n) {
 }
 
 float simpson_simd(float a, float b, int n) {
+	perf::Region region("simpson_simd", 4.0 * n);
 	if (n % 2 != 0) n++;
 	float h = (b - a) / n;
 
@@ -112,58 +127,49 @@ float simpson_simd(float a, float b, int n) {
 	return (test_function(a) + test_function(b) + 4 * total_odd + 2 * total_even) * h / 3.0f;
 }
 
-int main() {
+int main(int argc, char** argv) {
 	const float a = 0.0f;
 	const float b = 1.0f;
-	const int n = 1000000; 
-
-	auto start = std::chrono::high_resolution_clock::now();
-	float pi_rect = rectangle(a, b, n, test_function);
-	auto stop = std::chrono::high_resolution_clock::now();
-	auto duration_rect = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-	start = std::chrono::high_resolution_clock::now();
-	float pi_trap = trapezoid(a, b, n, test_function);
-	stop = std::chrono::high_resolution_clock::now();
-	auto duration_trap = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-	start = std::chrono::high_resolution_clock::now();
-	float pi_simp = simpson(a, b, n, test_function);
-	stop = std::chrono::high_resolution_clock::now();
-	auto duration_simp = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-	start = std::chrono::high_resolution_clock::now();
-	float pi_rect_simd = rectangle_simd(a, b, n, test_function);
-	stop = std::chrono::high_resolution_clock::now();
-	auto duration_rect_simd = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-	start = std::chrono::high_resolution_clock::now();
-	float pi_trap_simd = trapezoid_simd(a, b, n);
-	stop = std::chrono::high_resolution_clock::now();
-	auto duration_trap_simd = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-	start = std::chrono::high_resolution_clock::now();
-	float pi_simpson_simd = simpson_simd(a, b, n);
-	stop = std::chrono::high_resolution_clock::now();
-	auto duration_simpson_simd = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-
-	std::cout << "Rectangles:\n";
-	std::cout << "  Result: " << pi_rect << "\n";
-	std::cout << "  Time: " << duration_rect.count() << " microsec\n";
-	std::cout << "  Result (SIMD): " << pi_rect_simd << "\n";
-	std::cout << "  Time (SIMD): " << duration_rect_simd.count() << " microsec\n\n";
-
-	std::cout << "Trapezoids:\n";
-	std::cout << "  Result: " << pi_trap << "\n";
-	std::cout << "  Time: " << duration_trap.count() << " microsec\n";
-	std::cout << "  Result (SIMD): " << pi_trap_simd << "\n";
-	std::cout << "  Time (SIMD): " << duration_trap_simd.count() << " microsec\n\n";
-
-	std::cout << "Simpon:\n";
-	std::cout << "  Result: " << pi_simp << "\n";
-	std::cout << "  Time: " << duration_simp.count() << " microsec\n";
-	std::cout << "  Result (SIMD): " << pi_simpson_simd << "\n";
-	std::cout << "  Time (SIMD): " << duration_simpson_simd.count() << " microsec\n\n";
-
-	return 0;
+
+	bench::Suite suite("Paracomp1", argc, argv);
+	const std::string policy_name = suite.options().get_string("policy", "threads+simd");
+	const pc::RuntimePolicy policy = pc::parse_policy(policy_name);
+
+	for (long long n : suite.options().get_list("n", { 1000000 })) {
+		const int ni = (int)n;
+		const std::string params = bench::params({ { "n", n } });
+		float pi_rect = 0, pi_trap = 0, pi_simp = 0;
+		float pi_rect_simd = 0, pi_trap_simd = 0, pi_simpson_simd = 0;
+
+		suite.run("rectangle", params, bench::evals(n), [&] { pi_rect = rectangle(a, b, ni, test_function); });
+		suite.run("rectangle_simd", params, bench::evals(n), [&] { pi_rect_simd = rectangle_simd(a, b, ni, test_function); });
+		suite.run("trapezoid", params, bench::evals(n), [&] { pi_trap = trapezoid(a, b, ni, test_function); });
+		suite.run("trapezoid_simd", params, bench::evals(n), [&] { pi_trap_simd = trapezoid_simd(a, b, ni); });
+		suite.run("simpson", params, bench::evals(n), [&] { pi_simp = simpson(a, b, ni, test_function); });
+		suite.run("simpson_simd", params, bench::evals(n), [&] { pi_simpson_simd = simpson_simd(a, b, ni); });
+
+		const std::string policy_params = params + " policy=" + policy_name;
+		float pi_rect_policy = 0, pi_trap_policy = 0, pi_simp_policy = 0;
+		suite.run("integrate_rectangle", policy_params, bench::evals(n), [&] { pi_rect_policy = pc::integrate(policy, pc::rectangle, TestFunction(), a, b, n); });
+		suite.run("integrate_trapezoid", policy_params, bench::evals(n), [&] { pi_trap_policy = pc::integrate(policy, pc::trapezoid, TestFunction(), a, b, n); });
+		suite.run("integrate_simpson", policy_params, bench::evals(n), [&] { pi_simp_policy = pc::integrate(policy, pc::simpson, TestFunction(), a, b, n); });
+
+		std::cout << "\nRectangles:\n";
+		std::cout << "  Result: " << pi_rect << "\n";
+		std::cout << "  Result (SIMD): " << pi_rect_simd << "\n";
+		std::cout << "  Result (" << policy_name << "): " << pi_rect_policy << "\n\n";
+
+		std::cout << "Trapezoids:\n";
+		std::cout << "  Result: " << pi_trap << "\n";
+		std::cout << "  Result (SIMD): " << pi_trap_simd << "\n";
+		std::cout << "  Result (" << policy_name << "): " << pi_trap_policy << "\n\n";
+
+		std::cout << "Simpon:\n";
+		std::cout << "  Result: " << pi_simp << "\n";
+		std::cout << "  Result (SIMD): " << pi_simpson_simd << "\n";
+		std::cout << "  Result (" << policy_name << "): " << pi_simp_policy << "\n\n";
+	}
+
+	perf::report();
+	return suite.report();
 }
\ No newline at end of file